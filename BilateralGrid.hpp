@@ -0,0 +1,169 @@
+/**
+ *
+ * @file edge-preserving smoothing with a bilateral grid.
+ *
+ * Pixels are splatted into a coarse 3D grid over (x, y, luma), with one
+ * cell per sigma_s pixels and per sigma_r grey levels. The grid is blurred
+ * along all three axes, then every pixel reads its value back by trilinear
+ * interpolation at its own (x, y, luma). Smoothing crosses only cells of
+ * similar luma, so edges survive, and the cost is proportional to the pixel
+ * count plus the (small) grid size, not to the kernel area.
+ */
+
+#if !defined(__BILATERAL_GRID_H__)
+#define __BILATERAL_GRID_H__
+
+#include "ColorConvert.hpp"
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+namespace BilateralGrid {
+
+class Grid {
+public:
+  // channels per cell: R, G, B weighted sums and the weight
+  static const int C = 4;
+
+  Grid(int gx, int gy, int gz)
+      : nx{gx}, ny{gy}, nz{gz}, cells((size_t)gx * gy * gz * C, 0.0F) {}
+
+  float *at(int x, int y, int z) {
+    return cells.data() + (((size_t)y * nx + x) * nz + z) * C;
+  }
+
+  int nx, ny, nz;
+  vector<float> cells;
+};
+
+/**
+ * @brief one [1 4 6 4 1] / 16 pass along an axis of the grid (the discrete
+ * approximation of a Gaussian of one cell), parallel over the other two.
+ */
+static void blur_axis(Grid &grid, int axis) {
+  const int n = axis == 0 ? grid.nx : (axis == 1 ? grid.ny : grid.nz);
+  const size_t step = axis == 0   ? (size_t)grid.nz * Grid::C
+                      : axis == 1 ? (size_t)grid.nx * grid.nz * Grid::C
+                                  : Grid::C;
+  const int lines = axis == 0   ? grid.ny * grid.nz
+                    : axis == 1 ? grid.nx * grid.nz
+                                : grid.nx * grid.ny;
+
+  Parallel::parallel_for(0, lines, [&](int s, int e) {
+    vector<float> line((size_t)(n + 4) * Grid::C);
+    for (int l = s; l < e; l++) {
+      float *base;
+      if (axis == 0)
+        base = grid.at(0, l / grid.nz, l % grid.nz);
+      else if (axis == 1)
+        base = grid.at(l / grid.nz, 0, l % grid.nz);
+      else
+        base = grid.at(l % grid.nx, l / grid.nx, 0);
+
+      // zero padding: empty cells carry no weight
+      fill(line.begin(), line.end(), 0.0F);
+      for (int i = 0; i < n; i++)
+        copy(base + i * step, base + i * step + Grid::C,
+             line.begin() + (i + 2) * Grid::C);
+      for (int i = 0; i < n; i++) {
+        const float *p = line.data() + (i + 2) * Grid::C;
+        float *q = base + i * step;
+        for (int k = 0; k < Grid::C; k++)
+          q[k] = (p[k - 2 * Grid::C] + 4 * p[k - Grid::C] + 6 * p[k] +
+                  4 * p[k + Grid::C] + p[k + 2 * Grid::C]) /
+                 16;
+      }
+    }
+  });
+}
+
+/**
+ * @brief bilateral filter of an RGBA image.
+ *
+ * @param sigma_s spatial standard deviation, pixels
+ * @param sigma_r range standard deviation, grey levels (0 to 255)
+ */
+static Image filter(Image &img, float sigma_s = 16, float sigma_r = 24) {
+  Image out = img;
+  if (img.width == 0 || img.height == 0)
+    return out;
+  sigma_s = max(sigma_s, 1.0F);
+  sigma_r = max(sigma_r, 1.0F);
+
+  // the [1 4 6 4 1] / 16 pass has a standard deviation of one cell
+  const int pad = 2;
+  const int nx = (int)((img.width - 1) / sigma_s) + 1 + 2 * pad;
+  const int ny = (int)((img.height - 1) / sigma_s) + 1 + 2 * pad;
+  const int nz = (int)(255 / sigma_r) + 1 + 2 * pad;
+  Grid grid{nx, ny, nz};
+
+  Gray8 luma = ColorConvert::to_grey(img);
+
+  // splat: each pixel goes to its nearest cell. Workers own disjoint bands
+  // of grid rows, so no two threads touch the same cell.
+  Parallel::parallel_for(0, ny, [&](int s, int e) {
+    const int y0 = max(0, (int)ceil((s - pad - 0.5F) * sigma_s));
+    const int y1 = min(img.height, (int)ceil((e - pad - 0.5F) * sigma_s));
+    for (int y = y0; y < y1; y++) {
+      const int gy = (int)(y / sigma_s + 0.5F) + pad;
+      if (gy < s || gy >= e)
+        continue;
+      const GLubyte *p = img.bytes.data() + 4 * (size_t)y * img.width;
+      const GLubyte *l = luma.row(y);
+      for (int x = 0; x < img.width; x++, p += 4) {
+        float *cell = grid.at((int)(x / sigma_s + 0.5F) + pad, gy,
+                              (int)(l[x] / sigma_r + 0.5F) + pad);
+        cell[0] += p[0];
+        cell[1] += p[1];
+        cell[2] += p[2];
+        cell[3] += 1;
+      }
+    }
+  });
+
+  for (int axis = 0; axis < 3; axis++)
+    blur_axis(grid, axis);
+
+  // slice
+  Parallel::parallel_for(0, img.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      const float fy = y / sigma_s + pad;
+      const int y0 = (int)fy;
+      const float wy = fy - y0;
+      GLubyte *p = out.bytes.data() + 4 * (size_t)y * img.width;
+      const GLubyte *l = luma.row(y);
+
+      for (int x = 0; x < img.width; x++, p += 4) {
+        const float fx = x / sigma_s + pad, fz = l[x] / sigma_r + pad;
+        const int x0 = (int)fx, z0 = (int)fz;
+        const float wx = fx - x0, wz = fz - z0;
+
+        float acc[Grid::C] = {0, 0, 0, 0};
+        for (int dy = 0; dy < 2; dy++)
+          for (int dx = 0; dx < 2; dx++)
+            for (int dz = 0; dz < 2; dz++) {
+              const float w = (dy ? wy : 1 - wy) * (dx ? wx : 1 - wx) *
+                              (dz ? wz : 1 - wz);
+              const float *cell = grid.at(x0 + dx, y0 + dy, z0 + dz);
+              for (int k = 0; k < Grid::C; k++)
+                acc[k] += w * cell[k];
+            }
+
+        if (acc[3] <= 0)
+          continue;
+        for (int k = 0; k < 3; k++)
+          p[k] = (GLubyte)min(255.0F, max(0.0F, acc[k] / acc[3] + 0.5F));
+      }
+    }
+  });
+
+  return out;
+}
+
+} // namespace BilateralGrid
+
+#endif // __BILATERAL_GRID_H__
@@ -0,0 +1,227 @@
+/**
+ *
+ * @file Gaussian blur in constant time per pixel.
+ *
+ * Uses the Young / van Vliet recursive approximation: a third-order causal
+ * IIR pass followed by an anti-causal one reproduces a Gaussian of any sigma
+ * with a handful of multiply-adds per sample, so large sigmas cost the same
+ * as small ones.
+ *
+ * Rows are filtered one per task, all channels of a pixel together. Columns
+ * are filtered in strips: the recurrence runs down the image on a whole strip
+ * of a row at a time, so the inner loop is element-wise over contiguous
+ * floats (vectorised by the compiler) and a strip's state stays in cache.
+ */
+
+#if !defined(__BLUR_H__)
+#define __BLUR_H__
+
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+namespace Blur {
+
+struct Coefficients {
+  double b; // input gain
+  double a1, a2, a3;
+};
+
+static Coefficients coefficients_of_q(double q) {
+  const double q2 = q * q, q3 = q2 * q;
+  const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+  const double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+  const double b2 = -(1.4281 * q2 + 1.26661 * q3);
+  const double b3 = 0.422205 * q3;
+
+  Coefficients c;
+  c.a1 = b1 / b0;
+  c.a2 = b2 / b0;
+  c.a3 = b3 / b0;
+  // exactly 1 - (a1 + a2 + a3), so a constant signal stays constant
+  c.b = 1 - (c.a1 + c.a2 + c.a3);
+  return c;
+}
+
+/**
+ * @brief variance of the forward-backward filter, from its impulse response.
+ */
+static double variance_of(const Coefficients &c, int length) {
+  double w1 = 0, w2 = 0, w3 = 0, m0 = 0, m1 = 0, m2 = 0;
+  for (int n = 0; n < length; n++) {
+    const double w = (n == 0 ? c.b : 0) + c.a1 * w1 + c.a2 * w2 + c.a3 * w3;
+    w3 = w2;
+    w2 = w1;
+    w1 = w;
+    m0 += w;
+    m1 += n * w;
+    m2 += (double)n * n * w;
+  }
+  // the anti-causal pass mirrors the causal one, so variances add
+  return 2 * (m2 / m0 - (m1 / m0) * (m1 / m0));
+}
+
+/**
+ * @brief Young / van Vliet coefficients for sigma >= 0.5.
+ *
+ * The paper's closed form for q gives a kernel about 10% wider than asked
+ * for, so it is only the starting point: q is then refined by bisection
+ * until the variance of the actual filter matches sigma^2.
+ */
+static Coefficients coefficients(float sigma) {
+  const double q0 = sigma >= 2.5
+                        ? 0.98711 * sigma - 0.96330
+                        : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+  const int length = (int)(40 * sigma) + 64;
+  const double target = (double)sigma * sigma;
+
+  double lo = q0 * 0.5, hi = q0 * 1.5;
+  for (int i = 0; i < 50; i++) {
+    const double mid = (lo + hi) / 2;
+    if (variance_of(coefficients_of_q(mid), length) < target)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return coefficients_of_q((lo + hi) / 2);
+}
+
+/**
+ * @brief filter n samples of C interleaved channels in place, forwards then
+ * backwards. The borders start from the steady state of a constant signal.
+ */
+template <int C>
+static void recursive_1d(float *data, int n, const Coefficients &c) {
+  double w1[C], w2[C], w3[C];
+  for (int k = 0; k < C; k++)
+    w1[k] = w2[k] = w3[k] = data[k];
+  for (int i = 0; i < n; i++) {
+    float *p = data + i * C;
+    for (int k = 0; k < C; k++) {
+      const double w = c.b * p[k] + c.a1 * w1[k] + c.a2 * w2[k] + c.a3 * w3[k];
+      w3[k] = w2[k];
+      w2[k] = w1[k];
+      w1[k] = w;
+      p[k] = (float)w;
+    }
+  }
+
+  for (int k = 0; k < C; k++)
+    w1[k] = w2[k] = w3[k] = data[(n - 1) * C + k];
+  for (int i = n - 1; i >= 0; i--) {
+    float *p = data + i * C;
+    for (int k = 0; k < C; k++) {
+      const double w = c.b * p[k] + c.a1 * w1[k] + c.a2 * w2[k] + c.a3 * w3[k];
+      w3[k] = w2[k];
+      w2[k] = w1[k];
+      w1[k] = w;
+      p[k] = (float)w;
+    }
+  }
+}
+
+/**
+ * @brief the column recurrence for floats [c0, c1) of every row.
+ */
+static void recursive_columns(float *data, int row_floats, int height, int c0,
+                              int c1, const Coefficients &c) {
+  const int w = c1 - c0;
+  // the recursion state is double: at large sigma the input gain is tiny
+  // and float rounding in the feedback would shift flat regions
+  vector<double> state(3 * (size_t)w);
+  double *w1 = state.data(), *w2 = w1 + w, *w3 = w2 + w;
+
+  auto row = [&](int y) { return data + (size_t)y * row_floats + c0; };
+
+  copy(row(0), row(0) + w, w1);
+  copy(w1, w1 + w, w2);
+  copy(w1, w1 + w, w3);
+  for (int y = 0; y < height; y++) {
+    float *p = row(y);
+    for (int x = 0; x < w; x++) {
+      const double v = c.b * p[x] + c.a1 * w1[x] + c.a2 * w2[x] + c.a3 * w3[x];
+      w3[x] = w2[x];
+      w2[x] = w1[x];
+      w1[x] = v;
+      p[x] = (float)v;
+    }
+  }
+
+  copy(row(height - 1), row(height - 1) + w, w1);
+  copy(w1, w1 + w, w2);
+  copy(w1, w1 + w, w3);
+  for (int y = height - 1; y >= 0; y--) {
+    float *p = row(y);
+    for (int x = 0; x < w; x++) {
+      const double v = c.b * p[x] + c.a1 * w1[x] + c.a2 * w2[x] + c.a3 * w3[x];
+      w3[x] = w2[x];
+      w2[x] = w1[x];
+      w1[x] = v;
+      p[x] = (float)v;
+    }
+  }
+}
+
+/**
+ * @brief blur a width x height buffer of C interleaved float channels in
+ * place.
+ */
+template <int C>
+static void gaussian_inplace(float *data, int width, int height,
+                             float sigma) {
+  if (sigma < 0.5F || width <= 0 || height <= 0)
+    return;
+  const Coefficients c = coefficients(sigma);
+  const int row_floats = width * C;
+
+  Parallel::parallel_for(0, height, [&](int s, int e) {
+    for (int y = s; y < e; y++)
+      recursive_1d<C>(data + (size_t)y * row_floats, width, c);
+  });
+
+  const int strip = 256;
+  const int strips = (row_floats + strip - 1) / strip;
+  Parallel::parallel_each(0, strips, [&](int i) {
+    recursive_columns(data, row_floats, height, i * strip,
+                      min(row_floats, (i + 1) * strip), c);
+  });
+}
+
+static Plane<float> gaussian(const Plane<float> &plane, float sigma) {
+  Plane<float> out = plane;
+  gaussian_inplace<1>(out.data.data(), out.width, out.height, sigma);
+  return out;
+}
+
+static Gray8 gaussian(const Gray8 &plane, float sigma) {
+  Plane<float> tmp{plane.width, plane.height};
+  copy(plane.data.begin(), plane.data.end(), tmp.data.begin());
+  gaussian_inplace<1>(tmp.data.data(), tmp.width, tmp.height, sigma);
+
+  Gray8 out{plane.width, plane.height};
+  for (size_t i = 0; i < out.data.size(); i++)
+    out.data[i] = (GLubyte)min(255.0F, max(0.0F, tmp.data[i] + 0.5F));
+  return out;
+}
+
+/**
+ * @brief Gaussian blur of all four channels of an RGBA image.
+ */
+static Image gaussian(const Image &img, float sigma) {
+  vector<float> tmp(img.bytes.begin(), img.bytes.end());
+  gaussian_inplace<4>(tmp.data(), img.width, img.height, sigma);
+
+  Image out = img;
+  for (size_t i = 0; i < tmp.size(); i++)
+    out.bytes[i] = (GLubyte)min(255.0F, max(0.0F, tmp[i] + 0.5F));
+  return out;
+}
+
+} // namespace Blur
+
+#endif // __BLUR_H__
@@ -0,0 +1,288 @@
+/**
+ *
+ * @file Canny edge detector.
+ *
+ * Gaussian pre-blur, Sobel gradient, non-maximum suppression along the
+ * quantised gradient orientation and double-threshold hysteresis.
+ *
+ * The first three stages stream over horizontal bands of rows: each worker
+ * keeps small ring buffers of blurred rows and gradient rows, so no
+ * full-size float image is ever materialised. Only the 8-bit classification
+ * map is image sized.
+ */
+
+#if !defined(__CANNY_H__)
+#define __CANNY_H__
+
+#include "ColorConvert.hpp"
+#include "Image.hpp"
+#include "ImageUtils.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+namespace Canny {
+
+struct CannyOptions {
+  float sigma = 1.4F;
+  // gradient magnitude thresholds; high < 0 picks them with
+  // ImageUtils::auto_edge_threshold (low = low_ratio * high)
+  float low = 40;
+  float high = 100;
+  float low_ratio = 0.4F;
+  int band_rows = 64;
+};
+
+enum : GLubyte { NONE = 0, WEAK = 1, STRONG = 2 };
+
+/**
+ * @brief rows of a band's intermediate stage, kept in a ring indexed by
+ * image row and filled on demand.
+ */
+class RowRing {
+public:
+  RowRing(int slots, int width, function<void(int, float *)> fill)
+      : rows((size_t)slots * width), tags(slots, INT32_MIN), w{width},
+        producer{fill} {}
+
+  const float *get(int y) {
+    const int slot = ((y % (int)tags.size()) + (int)tags.size()) %
+                     (int)tags.size();
+    float *row = rows.data() + (size_t)slot * w;
+    if (tags[slot] != y) {
+      producer(y, row);
+      tags[slot] = y;
+    }
+    return row;
+  }
+
+private:
+  vector<float> rows;
+  vector<int> tags;
+  int w;
+  function<void(int, float *)> producer;
+};
+
+static vector<float> gaussian_kernel(float sigma) {
+  const int radius = max(1, (int)ceil(3 * sigma));
+  vector<float> k(2 * radius + 1);
+  float sum = 0;
+  for (int i = -radius; i <= radius; i++)
+    sum += k[i + radius] = exp(-(i * i) / (2 * sigma * sigma));
+  for (auto &v : k)
+    v /= sum;
+  return k;
+}
+
+/**
+ * @brief blur, gradient, NMS and thresholding for rows [y0, y1) of the
+ * classification map.
+ */
+static void classify_band(Image &img, Gray8 &cls, int y0, int y1,
+                          const vector<float> &kernel, float low,
+                          float high) {
+  const int w = img.width, h = img.height;
+  const int r = (int)kernel.size() / 2;
+  auto clamp_y = [&](int y) { return min(max(y, 0), h - 1); };
+
+  // grey, blurred horizontally
+  vector<float> grey(w);
+  RowRing hblur{2 * r + 2, w, [&](int y, float *out) {
+                  const GLubyte *p =
+                      img.bytes.data() + 4 * (size_t)clamp_y(y) * w;
+                  for (int x = 0; x < w; x++, p += 4)
+                    grey[x] = ColorConvert::grey_f(p[0], p[1], p[2]);
+                  for (int x = 0; x < w; x++) {
+                    float acc = 0;
+                    for (int i = -r; i <= r; i++)
+                      acc += kernel[i + r] * grey[min(max(x + i, 0), w - 1)];
+                    out[x] = acc;
+                  }
+                }};
+
+  // fully blurred
+  RowRing blur{4, w, [&](int y, float *out) {
+                 fill(out, out + w, 0.0F);
+                 for (int i = -r; i <= r; i++) {
+                   const float *src = hblur.get(clamp_y(y + i));
+                   const float k = kernel[i + r];
+                   for (int x = 0; x < w; x++)
+                     out[x] += k * src[x];
+                 }
+               }};
+
+  // gx, gy and magnitude of row y, packed as three runs of w floats
+  RowRing grad{4, 3 * w, [&](int y, float *out) {
+                 const float *up = blur.get(clamp_y(y - 1));
+                 const float *mid = blur.get(clamp_y(y));
+                 const float *down = blur.get(clamp_y(y + 1));
+                 for (int x = 0; x < w; x++) {
+                   const int l = max(x - 1, 0), rr = min(x + 1, w - 1);
+                   const float gx = (up[rr] - up[l]) + 2 * (mid[rr] - mid[l]) +
+                                    (down[rr] - down[l]);
+                   const float gy = (down[l] + 2 * down[x] + down[rr]) -
+                                    (up[l] + 2 * up[x] + up[rr]);
+                   out[x] = gx;
+                   out[w + x] = gy;
+                   out[2 * w + x] = sqrt(gx * gx + gy * gy);
+                 }
+               }};
+
+  // tan(22.5) and tan(67.5), to quantise atan2(gy, gx) without calling it
+  const float t1 = 0.41421356F, t2 = 2.41421356F;
+
+  for (int y = y0; y < y1; y++) {
+    GLubyte *out = cls.row(y);
+    if (y == 0 || y == h - 1) {
+      fill(out, out + w, NONE);
+      continue;
+    }
+    const float *mag_up = grad.get(y - 1) + 2 * w;
+    const float *mag_down = grad.get(y + 1) + 2 * w;
+    const float *g = grad.get(y);
+    const float *mag = g + 2 * w;
+
+    out[0] = out[w - 1] = NONE;
+    for (int x = 1; x < w - 1; x++) {
+      const float m = mag[x];
+      if (m < low) {
+        out[x] = NONE;
+        continue;
+      }
+      const float ax = fabs(g[x]), ay = fabs(g[w + x]);
+      float n1, n2;
+      if (ay <= t1 * ax) { // horizontal gradient
+        n1 = mag[x - 1];
+        n2 = mag[x + 1];
+      } else if (ay >= t2 * ax) { // vertical gradient
+        n1 = mag_up[x];
+        n2 = mag_down[x];
+      } else if ((g[x] > 0) == (g[w + x] > 0)) { // 45 degrees
+        n1 = mag_up[x - 1];
+        n2 = mag_down[x + 1];
+      } else { // 135 degrees
+        n1 = mag_up[x + 1];
+        n2 = mag_down[x - 1];
+      }
+      // ties keep one side only so plateaus stay one pixel wide
+      if (m > n1 && m >= n2)
+        out[x] = m >= high ? STRONG : WEAK;
+      else
+        out[x] = NONE;
+    }
+  }
+}
+
+/**
+ * @brief promote WEAK pixels 8-connected to a seed, staying within rows
+ * [y0, y1).
+ */
+static void flood_band(Gray8 &cls, int y0, int y1, vector<Point> &stack) {
+  while (!stack.empty()) {
+    const Point p = stack.back();
+    stack.pop_back();
+    for (int dy = -1; dy <= 1; dy++) {
+      const int y = p.y + dy;
+      if (y < y0 || y >= y1)
+        continue;
+      for (int dx = -1; dx <= 1; dx++) {
+        const int x = p.x + dx;
+        if (x < 0 || x >= cls.width || cls(y, x) != WEAK)
+          continue;
+        cls(y, x) = STRONG;
+        stack.push_back(Point{x, y});
+      }
+    }
+  }
+}
+
+/**
+ * @brief Canny edge map: 255 on edges, 0 elsewhere.
+ */
+static Gray8 detect(Image &img, CannyOptions opts = {}) {
+  Gray8 cls{img.width, img.height};
+  if (img.width < 3 || img.height < 3)
+    return cls;
+
+  if (opts.high < 0) {
+    opts.high = ImageUtils::auto_edge_threshold(img);
+    opts.low = opts.high * opts.low_ratio;
+  }
+
+  const vector<float> kernel = gaussian_kernel(opts.sigma);
+  const int band = max(1, opts.band_rows);
+  const int bands = (img.height + band - 1) / band;
+  auto band_end = [&](int b) { return min(img.height, (b + 1) * band); };
+
+  Parallel::parallel_each(0, bands, [&](int b) {
+    classify_band(img, cls, b * band, band_end(b), kernel, opts.low,
+                  opts.high);
+  });
+
+  // hysteresis: flood every band from its strong pixels in parallel, then
+  // hand edges that cross band borders to the neighbour and repeat
+  vector<vector<Point>> seeds(bands);
+  Parallel::parallel_each(0, bands, [&](int b) {
+    for (int y = b * band; y < band_end(b); y++)
+      for (int x = 0; x < img.width; x++)
+        if (cls(y, x) == STRONG)
+          seeds[b].push_back(Point{x, y});
+  });
+
+  bool pending = true;
+  while (pending) {
+    Parallel::parallel_each(0, bands, [&](int b) {
+      flood_band(cls, b * band, band_end(b), seeds[b]);
+    });
+
+    pending = false;
+    for (int b = 1; b < bands; b++) {
+      const int below = b * band - 1, above = b * band;
+      for (int x = 0; x < img.width; x++) {
+        for (int dx = -1; dx <= 1; dx++) {
+          const int nx = x + dx;
+          if (nx < 0 || nx >= img.width)
+            continue;
+          if (cls(below, x) == STRONG && cls(above, nx) == WEAK) {
+            cls(above, nx) = STRONG;
+            seeds[b].push_back(Point{nx, above});
+            pending = true;
+          }
+          if (cls(above, x) == STRONG && cls(below, nx) == WEAK) {
+            cls(below, nx) = STRONG;
+            seeds[b - 1].push_back(Point{nx, below});
+            pending = true;
+          }
+        }
+      }
+    }
+  }
+
+  for (auto &v : cls.data)
+    v = v == STRONG ? 255 : 0;
+  return cls;
+}
+
+/**
+ * @brief `detect` as a black and white RGBA image, like
+ * `ImageUtils::generate_edge_image`.
+ */
+static Image edge_image(Image &img, const CannyOptions &opts = {}) {
+  Gray8 edges = detect(img, opts);
+  Image out = img;
+  for (size_t i = 0; i < edges.data.size(); i++) {
+    GLubyte *p = out.bytes.data() + 4 * i;
+    p[0] = p[1] = p[2] = edges.data[i];
+    p[3] = 255;
+  }
+  return out;
+}
+
+} // namespace Canny
+
+#endif // __CANNY_H__
@@ -0,0 +1,311 @@
+/**
+ *
+ * @file colour-space conversion kernels.
+ *
+ * Two kinds of kernels:
+ *
+ * - fixed-point integer kernels (RGB <-> YCbCr BT.601 / BT.709, 8-bit grey)
+ *   that convert interleaved RGBA into planar buffers. Their inner loops are
+ *   plain multiply-adds on integers with no table lookups or branches, so the
+ *   compiler vectorises them.
+ * - per-channel lookup tables for the float paths used by ImageUtils (grey for
+ *   `sobel`, `luma_cal`, `to_ybr`) and for sRGB <-> linear.
+ *
+ * Accuracy, against the double-precision formulas, over all 2^24 RGB inputs:
+ *
+ * - `to_ycbcr` / `grey8`: coefficients are rounded to 16 fractional bits and
+ *   the result rounded to nearest, so every output is within 1 of the rounded
+ *   double result.
+ * - `from_ycbcr`: within 1 of the rounded double result; a round trip
+ *   RGB -> YCbCr -> RGB is within 1 per channel for full range and within 2
+ *   for studio range, which has fewer code values.
+ * - `grey_f`, `luma_third`, `legacy_ybr`: tables hold the exact products the
+ *   float code computed, and are summed in the same order, so results are
+ *   bit-identical to the previous per-pixel arithmetic (unless the compiler
+ *   was contracting that arithmetic into fused multiply-adds).
+ * - `linear16`: rounded to nearest of 65535 * linear; `srgb8` indexes a 4096
+ *   entry table by the top 12 bits, so it's exact for every value produced by
+ *   `linear16` and within 1 otherwise.
+ */
+
+#if !defined(__COLOR_CONVERT_H__)
+#define __COLOR_CONVERT_H__
+
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+using namespace std;
+
+namespace ColorConvert {
+
+enum Standard { BT601, BT709 };
+enum Range { FULL_RANGE, STUDIO_RANGE };
+
+static const int FIX_BITS = 16;
+static const int FIX_HALF = 1 << (FIX_BITS - 1);
+
+static inline int fix(double v) { return (int)lround(v * (1 << FIX_BITS)); }
+
+static inline GLubyte clamp8(int v) {
+  return (GLubyte)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+/**
+ * @brief fixed-point 8-bit grey with the BT.601 weights used by `sobel`.
+ */
+static inline int grey8(int r, int g, int b) {
+  return (19595 * r + 38470 * g + 7471 * b + FIX_HALF) >> FIX_BITS;
+}
+
+struct Coefficients {
+  // forward, offsets already include the rounding half
+  int yr, yg, yb, y_off;
+  int cbr, cbg, cbb, crr, crg, crb, c_off;
+  // inverse
+  int y_scale, y_sub, c_sub;
+  int r_cr, g_cb, g_cr, b_cb;
+};
+
+static Coefficients make_coefficients(Standard standard, Range range) {
+  const double kr = standard == BT601 ? 0.299 : 0.2126;
+  const double kb = standard == BT601 ? 0.114 : 0.0722;
+  const double kg = 1 - kr - kb;
+  const bool studio = range == STUDIO_RANGE;
+  const double ys = studio ? 219.0 / 255 : 1;
+  const double cs = studio ? 224.0 / 255 : 1;
+
+  Coefficients c;
+  c.yr = fix(kr * ys);
+  c.yg = fix(kg * ys);
+  c.yb = fix(kb * ys);
+  c.y_off = ((studio ? 16 : 0) << FIX_BITS) + FIX_HALF;
+
+  const double cb = cs / (2 * (1 - kb)), cr = cs / (2 * (1 - kr));
+  c.cbr = fix(-kr * cb);
+  c.cbg = fix(-kg * cb);
+  c.cbb = fix((1 - kb) * cb);
+  c.crr = fix((1 - kr) * cr);
+  c.crg = fix(-kg * cr);
+  c.crb = fix(-kb * cr);
+  c.c_off = (128 << FIX_BITS) + FIX_HALF;
+
+  c.y_scale = fix(1 / ys);
+  c.y_sub = studio ? 16 : 0;
+  c.c_sub = 128;
+  c.r_cr = fix(2 * (1 - kr) / cs);
+  c.g_cb = fix(-2 * kb * (1 - kb) / kg / cs);
+  c.g_cr = fix(-2 * kr * (1 - kr) / kg / cs);
+  c.b_cb = fix(2 * (1 - kb) / cs);
+  return c;
+}
+
+static const Coefficients &coefficients(Standard standard, Range range) {
+  static const Coefficients table[2][2] = {
+      {make_coefficients(BT601, FULL_RANGE),
+       make_coefficients(BT601, STUDIO_RANGE)},
+      {make_coefficients(BT709, FULL_RANGE),
+       make_coefficients(BT709, STUDIO_RANGE)}};
+  return table[standard][range];
+}
+
+struct PlanarYCbCr {
+  Gray8 y, cb, cr;
+};
+
+/**
+ * @brief convert one row of interleaved RGBA to planar Y, Cb and Cr.
+ */
+static void ycbcr_row(const GLubyte *rgba, int width, const Coefficients &c,
+                      GLubyte *y, GLubyte *cb, GLubyte *cr) {
+  for (int x = 0; x < width; x++) {
+    const int r = rgba[4 * x], g = rgba[4 * x + 1], b = rgba[4 * x + 2];
+    y[x] = clamp8((c.yr * r + c.yg * g + c.yb * b + c.y_off) >> FIX_BITS);
+    cb[x] = clamp8((c.cbr * r + c.cbg * g + c.cbb * b + c.c_off) >> FIX_BITS);
+    cr[x] = clamp8((c.crr * r + c.crg * g + c.crb * b + c.c_off) >> FIX_BITS);
+  }
+}
+
+static PlanarYCbCr to_ycbcr(Image &img, Standard standard = BT601,
+                            Range range = FULL_RANGE) {
+  const Coefficients &c = coefficients(standard, range);
+  PlanarYCbCr out{Gray8{img.width, img.height}, Gray8{img.width, img.height},
+                  Gray8{img.width, img.height}};
+  Parallel::parallel_for(0, img.height, [&](int s, int e) {
+    for (int y = s; y < e; y++)
+      ycbcr_row(img.bytes.data() + 4 * (size_t)y * img.width, img.width, c,
+                out.y.row(y), out.cb.row(y), out.cr.row(y));
+  });
+  return out;
+}
+
+static Image from_ycbcr(const PlanarYCbCr &planes, Standard standard = BT601,
+                        Range range = FULL_RANGE) {
+  const Coefficients &c = coefficients(standard, range);
+  Image out;
+  out.width = planes.y.width;
+  out.height = planes.y.height;
+  out.bytes.assign((size_t)out.width * out.height * 4, 255);
+
+  Parallel::parallel_for(0, out.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      const GLubyte *py = planes.y.row(y);
+      const GLubyte *pb = planes.cb.row(y);
+      const GLubyte *pr = planes.cr.row(y);
+      GLubyte *dst = out.bytes.data() + 4 * (size_t)y * out.width;
+      for (int x = 0; x < out.width; x++) {
+        const int yy = (py[x] - c.y_sub) * c.y_scale + FIX_HALF;
+        const int b = pb[x] - c.c_sub, r = pr[x] - c.c_sub;
+        dst[4 * x] = clamp8((yy + c.r_cr * r) >> FIX_BITS);
+        dst[4 * x + 1] = clamp8((yy + c.g_cb * b + c.g_cr * r) >> FIX_BITS);
+        dst[4 * x + 2] = clamp8((yy + c.b_cb * b) >> FIX_BITS);
+      }
+    }
+  });
+  return out;
+}
+
+/**
+ * @brief 8-bit grey plane (BT.601 weights).
+ */
+static Gray8 to_grey(Image &img) {
+  Gray8 out{img.width, img.height};
+  Parallel::parallel_for(0, img.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      const GLubyte *src = img.bytes.data() + 4 * (size_t)y * img.width;
+      GLubyte *dst = out.row(y);
+      for (int x = 0; x < img.width; x++)
+        dst[x] = (GLubyte)grey8(src[4 * x], src[4 * x + 1], src[4 * x + 2]);
+    }
+  });
+  return out;
+}
+
+/**
+ * @brief per-channel tables for the float conversions in ImageUtils.
+ */
+struct Tables {
+  float grey_r[256], grey_g[256], grey_b[256]; // 0.299F * v, ...
+  double third[256];                           // v / 3.0
+  double ybr[3][3][256];                       // to_ybr: [out][in channel]
+  uint16_t linear[256];                        // sRGB -> 65535 * linear
+  GLubyte srgb[4096];                          // linear (12 bit) -> sRGB
+
+  Tables() {
+    static const double k[3][3] = {{65.738, 129.057, 25.064},
+                                   {37.945, 74.494, 112.439},
+                                   {112.439, 94.154, 18.285}};
+    for (int v = 0; v < 256; v++) {
+      grey_r[v] = 0.299F * v;
+      grey_g[v] = 0.587F * v;
+      grey_b[v] = 0.114F * v;
+      third[v] = v / 3.0;
+      for (int o = 0; o < 3; o++)
+        for (int i = 0; i < 3; i++)
+          ybr[o][i][v] = k[o][i] * v / 256;
+
+      const double s = v / 255.0;
+      const double l = s <= 0.04045 ? s / 12.92 : pow((s + 0.055) / 1.055, 2.4);
+      linear[v] = (uint16_t)lround(l * 65535);
+    }
+    for (int i = 0; i < 4096; i++) {
+      // centre of the bucket of 16-bit values sharing these top 12 bits
+      const double l = (i * 16 + 7.5) / 65535;
+      const double s =
+          l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1 / 2.4) - 0.055;
+      srgb[i] = clamp8((int)lround(s * 255));
+    }
+    // make the round trip exact for every 8-bit value
+    for (int v = 0; v < 256; v++)
+      srgb[linear[v] >> 4] = (GLubyte)v;
+  }
+};
+
+static const Tables &tables() {
+  static const Tables t;
+  return t;
+}
+
+/**
+ * @brief 0.299F * r + 0.587F * g + 0.114F * b, from tables.
+ */
+static inline float grey_f(int r, int g, int b) {
+  const Tables &t = tables();
+  return t.grey_r[r] + t.grey_g[g] + t.grey_b[b];
+}
+
+/**
+ * @brief r / 3.0 + g / 3.0 + b / 3.0, from tables.
+ */
+static inline double luma_third(int r, int g, int b) {
+  const Tables &t = tables();
+  return t.third[r] + t.third[g] + t.third[b];
+}
+
+/**
+ * @brief the (Y, Cb, Cr) of `ImageUtils::to_ybr`, from tables.
+ */
+static inline void legacy_ybr(int r, int g, int b, double &y, double &cb,
+                              double &cr) {
+  const Tables &t = tables();
+  y = 16 + t.ybr[0][0][r] + t.ybr[0][1][g] + t.ybr[0][2][b];
+  cb = 128 + t.ybr[1][0][r] + t.ybr[1][1][g] + t.ybr[1][2][b];
+  cr = 128 + t.ybr[2][0][r] + t.ybr[2][1][g] + t.ybr[2][2][b];
+}
+
+static inline uint16_t linear16(GLubyte v) { return tables().linear[v]; }
+static inline GLubyte srgb8(uint16_t l) { return tables().srgb[l >> 4]; }
+
+struct PlanarLinear {
+  Plane<uint16_t> r, g, b;
+};
+
+/**
+ * @brief sRGB image to planar 16-bit linear light.
+ */
+static PlanarLinear to_linear(Image &img) {
+  const Tables &t = tables();
+  PlanarLinear out{Plane<uint16_t>{img.width, img.height},
+                   Plane<uint16_t>{img.width, img.height},
+                   Plane<uint16_t>{img.width, img.height}};
+  Parallel::parallel_for(0, img.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      const GLubyte *src = img.bytes.data() + 4 * (size_t)y * img.width;
+      uint16_t *r = out.r.row(y), *g = out.g.row(y), *b = out.b.row(y);
+      for (int x = 0; x < img.width; x++) {
+        r[x] = t.linear[src[4 * x]];
+        g[x] = t.linear[src[4 * x + 1]];
+        b[x] = t.linear[src[4 * x + 2]];
+      }
+    }
+  });
+  return out;
+}
+
+static Image from_linear(const PlanarLinear &planes) {
+  const Tables &t = tables();
+  Image out;
+  out.width = planes.r.width;
+  out.height = planes.r.height;
+  out.bytes.assign((size_t)out.width * out.height * 4, 255);
+  Parallel::parallel_for(0, out.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      GLubyte *dst = out.bytes.data() + 4 * (size_t)y * out.width;
+      const uint16_t *r = planes.r.row(y), *g = planes.g.row(y),
+                     *b = planes.b.row(y);
+      for (int x = 0; x < out.width; x++) {
+        dst[4 * x] = t.srgb[r[x] >> 4];
+        dst[4 * x + 1] = t.srgb[g[x] >> 4];
+        dst[4 * x + 2] = t.srgb[b[x] >> 4];
+      }
+    }
+  });
+  return out;
+}
+
+} // namespace ColorConvert
+
+#endif // __COLOR_CONVERT_H__
@@ -0,0 +1,266 @@
+/**
+ *
+ * @file radix-2 fast Fourier transforms of real 2D planes.
+ *
+ * Sizes are powers of two; callers zero-pad up to `next_size`. Bit-reversal
+ * tables and twiddles for each length are built once and kept in a plan
+ * cache, so repeated transforms of the same size only pay for the butterflies.
+ *
+ * A real plane of width W has a Hermitian spectrum, so only its W / 2 + 1
+ * non-negative frequency columns are stored. Row transforms take two real
+ * rows at a time packed into one complex row (the "two for one" trick), and
+ * the column pass then runs over half the columns. Columns are transformed
+ * in blocks of LANES side by side, so every butterfly is an element-wise
+ * operation over contiguous memory.
+ */
+
+#if !defined(__FFT_H__)
+#define __FFT_H__
+
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace FFT {
+
+typedef complex<float> Complex;
+
+// columns transformed together in the column pass
+static const int LANES = 16;
+
+/**
+ * @brief a * b without the NaN / infinity recovery of complex::operator*,
+ * which otherwise keeps the butterflies out of line and unvectorised.
+ */
+static inline Complex mul(const Complex &a, const Complex &b) {
+  return Complex(a.real() * b.real() - a.imag() * b.imag(),
+                 a.real() * b.imag() + a.imag() * b.real());
+}
+
+class Plan {
+public:
+  explicit Plan(int length) : n{length}, reverse(length), twiddle(length / 2) {
+    int bits = 0;
+    while ((1 << bits) < n)
+      bits++;
+    for (int i = 0; i < n; i++) {
+      int r = 0;
+      for (int b = 0; b < bits; b++)
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      reverse[i] = r;
+    }
+    for (int k = 0; k < n / 2; k++) {
+      const double a = -2 * M_PI * k / n;
+      twiddle[k] = Complex((float)cos(a), (float)sin(a));
+    }
+  }
+
+  int n;
+  vector<int> reverse;
+  vector<Complex> twiddle; // exp(-2 pi i k / n), k < n / 2
+};
+
+/**
+ * @brief the shared plan for a power-of-two length.
+ */
+static shared_ptr<const Plan> plan(int n) {
+  static mutex lock;
+  static map<int, shared_ptr<const Plan>> plans;
+
+  lock_guard<mutex> guard{lock};
+  auto &p = plans[n];
+  if (!p)
+    p = make_shared<const Plan>(n);
+  return p;
+}
+
+/**
+ * @brief smallest power of two >= n.
+ */
+static int next_size(int n) {
+  int s = 1;
+  while (s < n)
+    s <<= 1;
+  return s;
+}
+
+template <int L>
+static void butterflies(Complex *data, int lanes, const Plan &plan,
+                        bool inverse) {
+  // L > 0 fixes the lane count at compile time
+  if (L > 0)
+    lanes = L;
+  const int n = plan.n;
+  for (int len = 2; len <= n; len <<= 1) {
+    const int half = len / 2, step = n / len;
+    for (int start = 0; start < n; start += len) {
+      for (int j = 0; j < half; j++) {
+        Complex w = plan.twiddle[j * step];
+        if (inverse)
+          w = conj(w);
+        Complex *a = data + (size_t)(start + j) * lanes;
+        Complex *b = a + (size_t)half * lanes;
+        for (int l = 0; l < lanes; l++) {
+          const Complex t = mul(w, b[l]);
+          b[l] = a[l] - t;
+          a[l] += t;
+        }
+      }
+    }
+  }
+}
+
+/**
+ * @brief in-place unscaled transform of `lanes` interleaved sequences of
+ * length plan.n: element i of lane l is data[i * lanes + l].
+ */
+static void transform(Complex *data, int lanes, const Plan &plan,
+                      bool inverse) {
+  const int n = plan.n;
+  for (int i = 0; i < n; i++) {
+    const int r = plan.reverse[i];
+    if (r > i)
+      swap_ranges(data + (size_t)i * lanes, data + (size_t)(i + 1) * lanes,
+                  data + (size_t)r * lanes);
+  }
+
+  if (lanes == 1)
+    butterflies<1>(data, lanes, plan, inverse);
+  else if (lanes == LANES)
+    butterflies<LANES>(data, lanes, plan, inverse);
+  else
+    butterflies<0>(data, lanes, plan, inverse);
+}
+
+/**
+ * @brief half spectrum of a real width x height plane (both powers of two).
+ */
+class Spectrum {
+public:
+  Spectrum() : Spectrum{0, 0} {}
+  Spectrum(int w, int h)
+      : width{w}, height{h}, bins((size_t)(w / 2 + 1) * h) {}
+
+  int columns() const { return width / 2 + 1; }
+  Complex *row(int y) { return bins.data() + (size_t)y * columns(); }
+  const Complex *row(int y) const {
+    return bins.data() + (size_t)y * columns();
+  }
+
+  int width, height;
+  vector<Complex> bins;
+};
+
+/**
+ * @brief column pass over the whole spectrum, blocks of LANES columns in
+ * parallel.
+ */
+static void transform_columns(Spectrum &s, bool inverse) {
+  const int cols = s.columns();
+  const auto p = plan(s.height);
+  Parallel::parallel_each(0, (cols + LANES - 1) / LANES, [&](int block) {
+    const int c0 = block * LANES, lanes = min(LANES, cols - c0);
+    vector<Complex> buffer((size_t)s.height * lanes);
+    for (int y = 0; y < s.height; y++)
+      copy(s.row(y) + c0, s.row(y) + c0 + lanes,
+           buffer.begin() + (size_t)y * lanes);
+    transform(buffer.data(), lanes, *p, inverse);
+    for (int y = 0; y < s.height; y++)
+      copy(buffer.begin() + (size_t)y * lanes,
+           buffer.begin() + (size_t)(y + 1) * lanes, s.row(y) + c0);
+  });
+}
+
+/**
+ * @brief spectrum of `src` zero-padded to width x height (powers of two, at
+ * least the size of `src`).
+ */
+static Spectrum forward(const Plane<float> &src, int width, int height) {
+  Spectrum s{width, height};
+  const auto p = plan(width);
+  const int pairs = (min(src.height, height) + 1) / 2;
+
+  Parallel::parallel_for(0, pairs, [&](int begin, int end) {
+    vector<Complex> z(width);
+    for (int i = begin; i < end; i++) {
+      const int y0 = 2 * i, y1 = y0 + 1;
+      const float *a = src.row(y0);
+      const float *b = y1 < src.height ? src.row(y1) : nullptr;
+      const int w = min(src.width, width);
+      for (int x = 0; x < width; x++)
+        z[x] = x < w ? Complex(a[x], b ? b[x] : 0) : Complex(0, 0);
+      transform(z.data(), 1, *p, false);
+
+      // separate the two real rows: A = (Z[k] + Z*[n-k]) / 2,
+      // B = (Z[k] - Z*[n-k]) / 2i
+      Complex *ra = s.row(y0);
+      Complex *rb = y1 < height ? s.row(y1) : nullptr;
+      for (int k = 0; k <= width / 2; k++) {
+        const Complex zk = z[k], zn = conj(z[(width - k) & (width - 1)]);
+        ra[k] = (zk + zn) * 0.5F;
+        if (rb)
+          rb[k] = Complex(zk.imag() - zn.imag(), zn.real() - zk.real()) * 0.5F;
+      }
+    }
+  });
+
+  transform_columns(s, false);
+  return s;
+}
+
+/**
+ * @brief real plane of a half spectrum, scaled so that
+ * inverse(forward(x)) == x. Only the first `rows` rows are produced (all of
+ * them by default); the rest of the plane is left zero.
+ */
+static Plane<float> inverse(Spectrum s, int rows = -1) {
+  transform_columns(s, true);
+  rows = rows < 0 ? s.height : min(rows, s.height);
+
+  Plane<float> out{s.width, s.height};
+  const int width = s.width;
+  const auto p = plan(width);
+  const float scale = 1.0F / ((float)width * s.height);
+
+  const vector<Complex> zero(s.columns());
+
+  Parallel::parallel_for(0, (rows + 1) / 2, [&](int begin, int end) {
+    vector<Complex> z(width);
+    for (int i = begin; i < end; i++) {
+      const int y0 = 2 * i, y1 = y0 + 1;
+      const Complex *a = s.row(y0);
+      const Complex *b = y1 < s.height ? s.row(y1) : zero.data();
+      // both rows are real, so Z = A + iB with the upper half of A and B
+      // rebuilt from Hermitian symmetry
+      for (int k = 0; k <= width / 2; k++)
+        z[k] = Complex(a[k].real() - b[k].imag(), a[k].imag() + b[k].real());
+      for (int k = width / 2 + 1; k < width; k++)
+        z[k] = Complex(a[width - k].real() + b[width - k].imag(),
+                       b[width - k].real() - a[width - k].imag());
+      transform(z.data(), 1, *p, true);
+
+      float *ra = out.row(y0);
+      for (int x = 0; x < width; x++)
+        ra[x] = z[x].real() * scale;
+      if (y1 < s.height) {
+        float *rb = out.row(y1);
+        for (int x = 0; x < width; x++)
+          rb[x] = z[x].imag() * scale;
+      }
+    }
+  });
+
+  return out;
+}
+
+} // namespace FFT
+
+#endif // __FFT_H__
@@ -0,0 +1,285 @@
+/**
+ *
+ * @file incremental processing of frame sequences.
+ *
+ * Consecutive frames of a timelapse or video dump are mostly identical. A
+ * `TileTracker` hashes fixed-size tiles of every frame and reports which ones
+ * changed since the previous frame; the sequence operations below only
+ * recompute those tiles (plus the halo their kernel reads) and reuse the
+ * previous result everywhere else.
+ */
+
+#if !defined(__FRAME_SEQUENCE_H__)
+#define __FRAME_SEQUENCE_H__
+
+#include "Hash.hpp"
+#include "Image.hpp"
+#include "ImageUtils.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+namespace FrameSequence {
+
+class TileTracker {
+public:
+  TileTracker(int tile = 64) : tile_size{tile} {}
+
+  /**
+   * @brief hash the tiles of the new frame and mark the ones that differ
+   * from the previous frame.
+   *
+   * Every tile is dirty on the first frame or when the frame size changes.
+   *
+   * @return number of dirty tiles
+   */
+  int update(const Image &frame) {
+    const bool resized = frame.width != width || frame.height != height;
+    width = frame.width;
+    height = frame.height;
+    tiles_x = (width + tile_size - 1) / tile_size;
+    tiles_y = (height + tile_size - 1) / tile_size;
+
+    const int num_tiles = tiles_x * tiles_y;
+    if (resized)
+      hashes.assign(num_tiles, 0);
+    dirty.assign(num_tiles, 0);
+
+    Parallel::parallel_each(0, num_tiles, [&](int t) {
+      const uint64_t h = Hash::region(frame, tile_from(t), tile_to(t));
+      dirty[t] = resized || h != hashes[t];
+      hashes[t] = h;
+    });
+
+    return (int)count(dirty.begin(), dirty.end(), 1);
+  }
+
+  bool is_dirty(int tx, int ty) const {
+    if (tx < 0 || ty < 0 || tx >= tiles_x || ty >= tiles_y)
+      return false;
+    return dirty[ty * tiles_x + tx];
+  }
+
+  /**
+   * @brief whether any dirty tile intersects [from, to] (inclusive).
+   */
+  bool any_dirty(const Point &from, const Point &to) const {
+    for (int ty = max(0, from.y) / tile_size;
+         ty <= min(height - 1, to.y) / tile_size; ty++)
+      for (int tx = max(0, from.x) / tile_size;
+           tx <= min(width - 1, to.x) / tile_size; tx++)
+        if (is_dirty(tx, ty))
+          return true;
+    return false;
+  }
+
+  Point tile_from(int t) const {
+    return Point{(t % tiles_x) * tile_size, (t / tiles_x) * tile_size};
+  }
+
+  Point tile_to(int t) const {
+    return Point{min(width, (t % tiles_x + 1) * tile_size) - 1,
+                 min(height, (t / tiles_x + 1) * tile_size) - 1};
+  }
+
+  int num_tiles() const { return tiles_x * tiles_y; }
+
+  int tile_size;
+  int tiles_x = 0, tiles_y = 0;
+  int width = -1, height = -1;
+  vector<uint64_t> hashes;
+  vector<char> dirty;
+};
+
+/**
+ * @brief run `handler(from, to)` over every region of the frame whose output
+ * may have changed.
+ *
+ * A kernel with a `halo` pixel radius changes its output up to `halo` pixels
+ * outside a dirty tile, so a clean tile next to a dirty one recomputes only
+ * the strip within `halo` of that neighbour. Each output tile is owned by a
+ * single worker, so regions never overlap across threads.
+ */
+static void for_each_changed_region(
+    const TileTracker &tracker, int halo,
+    function<void(const Point &, const Point &)> handler) {
+  Parallel::parallel_each(0, tracker.num_tiles(), [&](int t) {
+    const int tx = t % tracker.tiles_x;
+    const int ty = t / tracker.tiles_x;
+    const Point from = tracker.tile_from(t);
+    const Point to = tracker.tile_to(t);
+
+    if (tracker.is_dirty(tx, ty)) {
+      handler(from, to);
+      return;
+    }
+    if (halo <= 0)
+      return;
+
+    for (int dy = -1; dy <= 1; dy++) {
+      for (int dx = -1; dx <= 1; dx++) {
+        if ((dx == 0 && dy == 0) || !tracker.is_dirty(tx + dx, ty + dy))
+          continue;
+        // strip of this tile within `halo` pixels of the dirty neighbour
+        Point s = from, e = to;
+        if (dx < 0)
+          e.x = min(to.x, from.x + halo - 1);
+        if (dx > 0)
+          s.x = max(from.x, to.x - halo + 1);
+        if (dy < 0)
+          e.y = min(to.y, from.y + halo - 1);
+        if (dy > 0)
+          s.y = max(from.y, to.y - halo + 1);
+        handler(s, e);
+      }
+    }
+  });
+}
+
+/**
+ * @brief `ImageUtils::generate_edge_image` over a frame sequence.
+ */
+class EdgeSequence {
+public:
+  EdgeSequence(int tile = 64) : tracker{tile} {}
+
+  Image &next(Image &frame) {
+    const bool resized =
+        frame.width != output.width || frame.height != output.height;
+    if (resized)
+      output = frame;
+    tracker.update(frame);
+
+    // sobel reads a 3x3 neighbourhood
+    for_each_changed_region(tracker, 1, [&](const Point &s, const Point &e) {
+      ImageUtils::edge_region(frame, output, s, e);
+    });
+    return output;
+  }
+
+  TileTracker tracker;
+  Image output;
+};
+
+/**
+ * @brief `ImageUtils::mosaics` over a frame sequence.
+ *
+ * Unlike `mosaics`, which matches each block against the partially painted
+ * image, blocks are matched against the untouched frame so every block's
+ * choice only depends on its own pixels and can be reused while they don't
+ * change. Thumbnails are then painted in the same order as `mosaics`.
+ */
+class MosaicSequence {
+public:
+  MosaicSequence(int tile = 64) : tracker{tile} {}
+
+  Image &next(Image &frame) {
+    ImageUtils::MosaicDataset &dataset = ImageUtils::mosaic_dataset();
+    output = frame;
+    if (dataset.images.empty())
+      return output;
+
+    const int block = ImageUtils::MOSAIC_BLOCK;
+    const bool resized = frame.width != tracker.width ||
+                         frame.height != tracker.height;
+    tracker.update(frame);
+
+    vector<Point> starts;
+    for (int x = 0; x < frame.width - block; x += block)
+      for (int y = 0; y < frame.height - block; y += block)
+        starts.push_back(Point{x, y});
+    if (resized)
+      choice.assign(starts.size(), -1);
+
+    Parallel::parallel_each(0, (int)starts.size(), [&](int i) {
+      const Point start = starts[i];
+      const Point end = start.shift_x(block).shift_y(block);
+      if (choice[i] >= 0 && !tracker.any_dirty(start, end))
+        return;
+      Image cropped = frame.crop(start, end);
+      choice[i] = ImageUtils::best_mosaic_entry(cropped);
+    });
+
+    for (size_t i = 0; i < starts.size(); i++)
+      output.paint(dataset.images[choice[i]], starts[i]);
+    return output;
+  }
+
+  TileTracker tracker;
+  vector<int> choice;
+  Image output;
+};
+
+/**
+ * @brief running `mse` and `image_l1` of every frame against a fixed
+ * reference, from cached per-tile sums.
+ */
+class MetricSequence {
+public:
+  MetricSequence(Image &ref, int tile = 64) : reference{ref}, tracker{tile} {}
+
+  /**
+   * @brief score the next frame. A frame whose size differs from the
+   * reference can't be compared: it is skipped, both metrics read infinity
+   * and the cached sums stay valid for the next frame of the right size.
+   *
+   * @return false if the frame was skipped
+   */
+  bool next(Image &frame) {
+    if (frame.width != reference.width || frame.height != reference.height) {
+      mse = l1 = numeric_limits<double>::infinity();
+      return false;
+    }
+    tracker.update(frame);
+    sums.resize(tracker.num_tiles());
+
+    Parallel::parallel_each(0, tracker.num_tiles(), [&](int t) {
+      if (!tracker.dirty[t])
+        return;
+      TileSums &tile = sums[t];
+      tile = TileSums{};
+      frame.for_range_pixel(
+          tracker.tile_from(t), tracker.tile_to(t), [&](int y, int x) {
+            auto src_color = frame(y, x);
+            auto tar_color = reference(y, x);
+            const int diff[3] = {get<0>(src_color) - get<0>(tar_color),
+                                 get<1>(src_color) - get<1>(tar_color),
+                                 get<2>(src_color) - get<2>(tar_color)};
+            for (int i = 0; i < 3; i++) {
+              tile.squared += diff[i] * diff[i];
+              tile.absolute += abs(diff[i]);
+            }
+          });
+    });
+
+    double squared = 0, absolute = 0;
+    for (const auto &tile : sums) {
+      squared += tile.squared;
+      absolute += tile.absolute;
+    }
+    mse = squared / (3.0 * frame.width * frame.height);
+    l1 = absolute;
+    return true;
+  }
+
+  double mse = 0;
+  double l1 = 0;
+
+private:
+  struct TileSums {
+    double squared = 0;
+    double absolute = 0;
+  };
+
+  Image &reference;
+  TileTracker tracker;
+  vector<TileSums> sums;
+};
+
+} // namespace FrameSequence
+
+#endif // __FRAME_SEQUENCE_H__
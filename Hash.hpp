@@ -0,0 +1,82 @@
+#if !defined(__HASH_H__)
+#define __HASH_H__
+
+#include "Image.hpp"
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace Hash {
+
+static inline uint64_t mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static inline uint64_t combine(uint64_t seed, uint64_t value) {
+  return mix(seed ^ (value + 0x9E3779B97F4A7C15ULL + (seed << 6) +
+                     (seed >> 2)));
+}
+
+/**
+ * @brief fast non-cryptographic 64-bit hash of a byte range.
+ *
+ * Consumes 8 bytes per step with a multiply-rotate round; good enough to
+ * detect changed content, not to resist adversarial collisions.
+ */
+static uint64_t bytes(const void *data, size_t length, uint64_t seed = 0) {
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h = seed ^ (length * 0x9E3779B97F4A7C15ULL);
+
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t k;
+    memcpy(&k, p + i, 8);
+    k *= 0x87C37B91114253D5ULL;
+    k = (k << 31) | (k >> 33);
+    k *= 0x4CF5AD432745937FULL;
+    h ^= k;
+    h = ((h << 27) | (h >> 37)) * 5 + 0x52DCE729;
+  }
+
+  uint64_t tail = 0;
+  memcpy(&tail, p + i, length - i);
+  h ^= tail * 0x87C37B91114253D5ULL;
+
+  return mix(h);
+}
+
+static uint64_t text(const std::string &s, uint64_t seed = 0) {
+  return bytes(s.data(), s.size(), seed);
+}
+
+/**
+ * @brief hash of the pixels in [from, to] (inclusive, like
+ * `Image::for_range_pixel`).
+ */
+static uint64_t region(const Image &img, const Point &from, const Point &to) {
+  uint64_t h = combine(from.x, from.y);
+  const size_t row_bytes = 4 * (size_t)(to.x - from.x + 1);
+  for (int y = from.y; y <= to.y; y++) {
+    const GLubyte *row =
+        img.bytes.data() + 4 * ((size_t)y * img.width + from.x);
+    h = combine(h, bytes(row, row_bytes, y));
+  }
+  return h;
+}
+
+/**
+ * @brief content hash of a whole image, including its dimensions.
+ */
+static uint64_t image(const Image &img) {
+  return bytes(img.bytes.data(), img.bytes.size(),
+               combine(img.width, img.height));
+}
+
+} // namespace Hash
+
+#endif // __HASH_H__
@@ -0,0 +1,253 @@
+/**
+ *
+ * @file histograms, automatic thresholds and CLAHE.
+ *
+ * Histograms are accumulated in one pass over the pixels, each worker into
+ * its own sub-histogram, and merged at the end. Everything here is O(N) in
+ * the number of pixels.
+ */
+
+#if !defined(__HISTOGRAM_H__)
+#define __HISTOGRAM_H__
+
+#include "ColorConvert.hpp"
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+namespace Histogram {
+
+template <int N> struct Bins {
+  array<uint64_t, N> count{};
+
+  static constexpr int size() { return N; }
+
+  uint64_t total() const {
+    uint64_t t = 0;
+    for (auto c : count)
+      t += c;
+    return t;
+  }
+
+  Bins &operator+=(const Bins &other) {
+    for (int i = 0; i < N; i++)
+      count[i] += other.count[i];
+    return *this;
+  }
+};
+
+struct ChannelHistogram {
+  Bins<256> r, g, b, a, luma;
+
+  ChannelHistogram &operator+=(const ChannelHistogram &other) {
+    r += other.r;
+    g += other.g;
+    b += other.b;
+    a += other.a;
+    luma += other.luma;
+    return *this;
+  }
+};
+
+/**
+ * @brief merge per-worker partial histograms built over row ranges.
+ */
+template <typename H>
+static H reduce_rows(int height, function<void(H &, int, int)> accumulate) {
+  const int workers = Parallel::worker_count();
+  vector<H> partial(workers);
+  Parallel::parallel_each(0, workers, [&](int w) {
+    const int s = (int)((long long)height * w / workers);
+    const int e = (int)((long long)height * (w + 1) / workers);
+    accumulate(partial[w], s, e);
+  });
+
+  H total{};
+  for (auto &p : partial)
+    total += p;
+  return total;
+}
+
+/**
+ * @brief R, G, B, A and luma histograms of the image, in one pass.
+ */
+static ChannelHistogram build(Image &img) {
+  return reduce_rows<ChannelHistogram>(
+      img.height, [&](ChannelHistogram &h, int s, int e) {
+        const GLubyte *p = img.bytes.data() + 4 * (size_t)s * img.width;
+        const GLubyte *end = img.bytes.data() + 4 * (size_t)e * img.width;
+        for (; p < end; p += 4) {
+          h.r.count[p[0]]++;
+          h.g.count[p[1]]++;
+          h.b.count[p[2]]++;
+          h.a.count[p[3]]++;
+          h.luma.count[ColorConvert::grey8(p[0], p[1], p[2])]++;
+        }
+      });
+}
+
+/**
+ * @brief histogram of a float plane over [0, max_value]; values outside are
+ * clamped into the first / last bin.
+ */
+template <int N>
+static Bins<N> build(const Plane<float> &values, float max_value) {
+  const float scale = max_value > 0 ? (N - 1) / max_value : 0;
+  return reduce_rows<Bins<N>>(
+      values.height, [&](Bins<N> &h, int s, int e) {
+        for (int y = s; y < e; y++) {
+          const float *row = values.row(y);
+          for (int x = 0; x < values.width; x++) {
+            const int bin = (int)(row[x] * scale + 0.5F);
+            h.count[min(max(bin, 0), N - 1)]++;
+          }
+        }
+      });
+}
+
+/**
+ * @brief Otsu's threshold: the bin that maximises the between-class
+ * variance. Values at or below the returned bin form the lower class.
+ */
+template <int N> static int otsu_threshold(const Bins<N> &h) {
+  const double total = (double)h.total();
+  if (total == 0)
+    return 0;
+
+  double sum = 0;
+  for (int i = 0; i < N; i++)
+    sum += (double)i * h.count[i];
+
+  double w0 = 0, sum0 = 0, best = -1;
+  int best_bin = 0;
+  for (int i = 0; i < N; i++) {
+    w0 += h.count[i];
+    sum0 += (double)i * h.count[i];
+    const double w1 = total - w0;
+    if (w0 == 0)
+      continue;
+    if (w1 == 0)
+      break;
+    const double mean0 = sum0 / w0;
+    const double mean1 = (sum - sum0) / w1;
+    const double between = w0 * w1 * (mean0 - mean1) * (mean0 - mean1);
+    if (between > best) {
+      best = between;
+      best_bin = i;
+    }
+  }
+  return best_bin;
+}
+
+/**
+ * @brief smallest bin at or below which `fraction` (0 to 1) of the samples
+ * lie.
+ */
+template <int N> static int percentile(const Bins<N> &h, double fraction) {
+  const double target = fraction * h.total();
+  double acc = 0;
+  for (int i = 0; i < N; i++) {
+    acc += h.count[i];
+    if (acc >= target)
+      return i;
+  }
+  return N - 1;
+}
+
+/**
+ * @brief contrast-limited adaptive histogram equalisation of the luma.
+ *
+ * The image is split into a grid of tiles; every tile gets an equalisation
+ * curve from its clipped luma histogram (clip_limit is relative to a flat
+ * histogram), built in parallel. Each pixel then blends the curves of the
+ * four nearest tile centres bilinearly. Chroma is preserved by adding the
+ * luma change to R, G and B alike.
+ */
+static Image clahe(Image &img, int grid_x = 8, int grid_y = 8,
+                   float clip_limit = 2.0F) {
+  Image out = img;
+  if (img.width == 0 || img.height == 0)
+    return out;
+
+  grid_x = max(1, min(grid_x, img.width));
+  grid_y = max(1, min(grid_y, img.height));
+  const int tile_w = (img.width + grid_x - 1) / grid_x;
+  const int tile_h = (img.height + grid_y - 1) / grid_y;
+  grid_x = (img.width + tile_w - 1) / tile_w;
+  grid_y = (img.height + tile_h - 1) / tile_h;
+
+  vector<array<GLubyte, 256>> lut(grid_x * grid_y);
+  Parallel::parallel_each(0, grid_x * grid_y, [&](int t) {
+    const int x0 = (t % grid_x) * tile_w, y0 = (t / grid_x) * tile_h;
+    const int x1 = min(x0 + tile_w, img.width);
+    const int y1 = min(y0 + tile_h, img.height);
+
+    array<uint32_t, 256> hist{};
+    for (int y = y0; y < y1; y++) {
+      const GLubyte *p = img.bytes.data() + 4 * ((size_t)y * img.width + x0);
+      for (int x = x0; x < x1; x++, p += 4)
+        hist[ColorConvert::grey8(p[0], p[1], p[2])]++;
+    }
+
+    const uint32_t pixels = (uint32_t)(x1 - x0) * (y1 - y0);
+    const uint32_t limit =
+        max<uint32_t>(1, (uint32_t)(clip_limit * pixels / 256));
+    uint32_t excess = 0;
+    for (auto &c : hist) {
+      if (c > limit) {
+        excess += c - limit;
+        c = limit;
+      }
+    }
+    const uint32_t share = excess / 256, rest = excess % 256;
+    for (int i = 0; i < 256; i++)
+      hist[i] += share + (i < (int)rest ? 1 : 0);
+
+    uint32_t cdf = 0;
+    for (int i = 0; i < 256; i++) {
+      cdf += hist[i];
+      lut[t][i] = (GLubyte)((cdf * 255ULL + pixels / 2) / pixels);
+    }
+  });
+
+  Parallel::parallel_for(0, img.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      // position relative to the tile centres
+      const float fy = (y + 0.5F) / tile_h - 0.5F;
+      const int ty0 = max(0, min((int)floor(fy), grid_y - 1));
+      const int ty1 = min(ty0 + 1, grid_y - 1);
+      const float wy = min(max(fy - ty0, 0.0F), 1.0F);
+
+      GLubyte *p = out.bytes.data() + 4 * (size_t)y * img.width;
+      for (int x = 0; x < img.width; x++, p += 4) {
+        const float fx = (x + 0.5F) / tile_w - 0.5F;
+        const int tx0 = max(0, min((int)floor(fx), grid_x - 1));
+        const int tx1 = min(tx0 + 1, grid_x - 1);
+        const float wx = min(max(fx - tx0, 0.0F), 1.0F);
+
+        const int l = ColorConvert::grey8(p[0], p[1], p[2]);
+        const float top = lut[ty0 * grid_x + tx0][l] * (1 - wx) +
+                          lut[ty0 * grid_x + tx1][l] * wx;
+        const float bottom = lut[ty1 * grid_x + tx0][l] * (1 - wx) +
+                             lut[ty1 * grid_x + tx1][l] * wx;
+        const int delta = (int)lround(top * (1 - wy) + bottom * wy) - l;
+
+        for (int k = 0; k < 3; k++)
+          p[k] = (GLubyte)min(255, max(0, p[k] + delta));
+      }
+    }
+  });
+
+  return out;
+}
+
+} // namespace Histogram
+
+#endif // __HISTOGRAM_H__
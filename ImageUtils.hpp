@@ -1,6 +1,11 @@
 #if !defined(__IMAGE_UTILS__)
 #define __IMAGE_UTILS__
+#include "ColorConvert.hpp"
+#include "Histogram.hpp"
 #include "Image.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include "Quantize.hpp"
 #include "gl_helper.hpp"
 #include <filesystem>
 #include <string>
@@ -31,8 +36,8 @@ static tuple<float, float, float> sobel(Image &img, int y, int x) {
     for (int j = 0; j < 3; j++) {
       if (img.valid_point(y + i, x + j)) {
         auto color = img(y + i, x + j);
-        const float grey = 0.299F * get<0>(color) + 0.587F * get<1>(color) +
-                           0.114F * get<2>(color);
+        const float grey =
+            ColorConvert::grey_f(get<0>(color), get<1>(color), get<2>(color));
         gx += sobel_x[i][j] * grey;
         gy += sobel_y[i][j] * grey;
       }
@@ -41,17 +46,73 @@ static tuple<float, float, float> sobel(Image &img, int y, int x) {
   return {gx, gy, atan2(gy, gx)};
 }
 
-static Image generate_edge_image(Image &img) {
-  Image return_img = img;
-  return_img.for_each_pixel([&](int y, int x) {
+/**
+ * @brief greyscale copy of the image, with the same weights as `sobel`.
+ */
+static Plane<float> grey_plane(Image &img) {
+  Plane<float> grey{img.width, img.height};
+  Parallel::parallel_for(0, img.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      const GLubyte *src = img.bytes.data() + 4 * (size_t)y * img.width;
+      float *dst = grey.row(y);
+      for (int x = 0; x < img.width; x++, src += 4)
+        dst[x] = ColorConvert::grey_f(src[0], src[1], src[2]);
+    }
+  });
+  return grey;
+}
+
+/**
+ * @brief `sobel` evaluated for every pixel of a greyscale plane at once.
+ *
+ * Uses the same kernels and zero padding as `sobel`, and writes the gradient
+ * magnitude and the gradient angle (radian) of each pixel.
+ */
+static void sobel_field(const Plane<float> &grey, Plane<float> &magnitude,
+                        Plane<float> &angle) {
+  magnitude = Plane<float>{grey.width, grey.height};
+  angle = Plane<float>{grey.width, grey.height};
+
+  Parallel::parallel_for(0, grey.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      for (int x = 0; x < grey.width; x++) {
+        float gx = 0;
+        float gy = 0;
+        for (int i = 0; i < 3; i++) {
+          for (int j = 0; j < 3; j++) {
+            if (grey.valid_point(y + i - 1, x + j - 1)) {
+              const float g = grey(y + i - 1, x + j - 1);
+              gx += sobel_x[i][j] * g;
+              gy += sobel_y[i][j] * g;
+            }
+          }
+        }
+        magnitude(y, x) = sqrt(gx * gx + gy * gy);
+        angle(y, x) = atan2(gy, gx);
+      }
+    }
+  });
+}
+
+/**
+ * @brief write the thresholded edge map of `img` for the pixels in
+ * [from, to] (inclusive) into `output`.
+ *
+ * Reads a one pixel halo around the range from `img`; `output` must have the
+ * size of `img`. Pixels whose gradient magnitude exceeds `threshold` are
+ * white.
+ */
+static void edge_region(Image &img, Image &output, const Point &from,
+                        const Point &to, float threshold = 127) {
+  output.for_range_pixel(from, to, [&](int y, int x) {
     auto result = sobel(img, y, x);
     float gx = get<0>(result);
     float gy = get<1>(result);
     float gradient2 = gx * gx + gy * gy;
 
-    auto color = return_img(y, x);
+    auto color = output(y, x);
 
-    if (gradient2 > 127 * 127) {
+    if (gradient2 > threshold * threshold) {
       // white
       get<0>(color) = 255;
       get<1>(color) = 255;
@@ -65,10 +126,69 @@ static Image generate_edge_image(Image &img) {
       get<3>(color) = 255;
     }
   });
+}
+
+static Image generate_edge_image(Image &img, float threshold = 127) {
+  Image return_img = img;
+  Parallel::parallel_for(0, img.height, [&](int s, int e) {
+    edge_region(img, return_img, Point{0, s}, Point{img.width - 1, e - 1},
+                threshold);
+  });
 
   return return_img;
 }
 
+enum ThresholdMethod { THRESHOLD_OTSU, THRESHOLD_PERCENTILE };
+
+// largest Sobel magnitude on 8-bit input: 4 * 255 * sqrt(2)
+static const float MAX_SOBEL_MAGNITUDE = 1442.5F;
+
+/**
+ * @brief pick the edge threshold from the gradient magnitude histogram.
+ *
+ * @param method Otsu's method, or the magnitude below which `fraction` of
+ * the pixels lie
+ * @return threshold in gradient magnitude units, for `generate_edge_image`
+ */
+static float auto_edge_threshold(Image &img,
+                                 ThresholdMethod method = THRESHOLD_OTSU,
+                                 double fraction = 0.9) {
+  Plane<float> magnitude, angle;
+  sobel_field(grey_plane(img), magnitude, angle);
+
+  auto hist = Histogram::build<1024>(magnitude, MAX_SOBEL_MAGNITUDE);
+  const int bin = method == THRESHOLD_OTSU
+                      ? Histogram::otsu_threshold(hist)
+                      : Histogram::percentile(hist, fraction);
+  return (bin + 0.5F) * MAX_SOBEL_MAGNITUDE / (hist.size() - 1);
+}
+
+/**
+ * @brief `generate_edge_image` with the threshold chosen per image, after an
+ * optional CLAHE pre-pass to even out dark and bright regions.
+ */
+static Image generate_edge_image_auto(Image &img,
+                                      ThresholdMethod method = THRESHOLD_OTSU,
+                                      bool equalize = false) {
+  if (!equalize)
+    return generate_edge_image(img, auto_edge_threshold(img, method));
+
+  Image equalized = Histogram::clahe(img);
+  return generate_edge_image(equalized,
+                             auto_edge_threshold(equalized, method));
+}
+
+/**
+ * @brief reduce the image to at most `colors` colours, optionally with
+ * Floyd-Steinberg dithering. Linear in the number of pixels. With no colours
+ * to spend (`colors` <= 0) the image is returned unchanged.
+ */
+static Image quantize(Image &img, int colors,
+                      Quantize::Method method = Quantize::MEDIAN_CUT,
+                      bool dither = false) {
+  return Quantize::apply(img, Quantize::palette(img, colors, method), dither);
+}
+
 static Image dissolve(Image &source, Image &target) {
   Image output = target;
 
@@ -88,7 +208,7 @@ static Image dissolve(Image &source, Image &target) {
 
 static float
 luma_cal(tuple<GLubyte &, GLubyte &, GLubyte &, GLubyte &> &color) {
-  return get<0>(color) / 3.0 + get<1>(color) / 3.0 + get<2>(color) / 3.0;
+  return ColorConvert::luma_third(get<0>(color), get<1>(color), get<2>(color));
 }
 
 static tuple<float, float, float>
@@ -97,9 +217,8 @@ to_ybr(const tuple<GLubyte &, GLubyte &, GLubyte &, GLubyte &> &color) {
   auto g = get<1>(color);
   auto b = get<2>(color);
 
-  auto y = 16 + 65.738 * r / 256 + 129.057 * g / 256 + 25.064 * b / 256;
-  auto cb = 128 + 37.945 * r / 256 + 74.494 * g / 256 + 112.439 * b / 256;
-  auto cr = 128 + 112.439 * r / 256 + 94.154 * g / 256 + 18.285 * b / 256;
+  double y, cb, cr;
+  ColorConvert::legacy_ybr(r, g, b, y, cb, cr);
 
   return {y, cb, cr};
 }
@@ -268,35 +387,81 @@ static double image_l2(Image &src, Image &tar) {
   return distance;
 }
 
-static Image mosaics(Image &img) {
-  // load images dataset
-  static vector<Image> dataset{};
-  static vector<string> alias{};
-  static bool init = false;
+static const int MOSAIC_BLOCK = 5;
 
-  const int DWIDTH = 5;
-  const int DHEIGHT = DWIDTH;
-  int count = 0;
+struct MosaicDataset {
+  vector<Image> images;
+  vector<string> alias;
+};
+
+/**
+ * @brief thumbnails used by `mosaics`, loaded on first use.
+ */
+static MosaicDataset &mosaic_dataset() {
+  static MosaicDataset dataset{};
+  static bool init = false;
 
   if (!init) {
+    int count = 0;
     std::string path =
         "/Users/dannylau/Program/COMP4411-Impressionist/thumbnails";
     for (const auto &entry : fs::directory_iterator(path)) {
       auto path = entry.path().u8string();
       if (path.find("bmp") != std::string::npos) {
-        alias.push_back(string{path});
-        dataset.push_back(Image::from(path.c_str()));
+        dataset.alias.push_back(string{path});
+        dataset.images.push_back(Image::from(path.c_str()));
 
         count++;
       }
     }
+    init = true;
+    debugger("loading done: %d", count);
+  }
+
+  return dataset;
+}
+
+/**
+ * @brief index of the thumbnail closest (L1) to `cropped`, or `fallback`
+ * if none beats the initial bound.
+ */
+static int best_mosaic_entry(Image &cropped, int fallback = 0) {
+  MosaicDataset &dataset = mosaic_dataset();
+
+  double best = 100000000;
+  int best_entry = fallback;
+  for (int i = 0; i < (int)dataset.images.size(); i++) {
+
+    // float sim = structural_similarity(cropped, dataset.images[i]);
+    // debugger("%s - similar: %.3f", dataset.alias[i].c_str(), sim);
+
+    // if (sim > best) {
+    //   best = sim;
+    //   best_entry = i;
+    // }
+
+    float sim = image_l1(cropped, dataset.images[i]);
+    debugger("%s - similar: %.3f", dataset.alias[i].c_str(), sim);
+
+    if (sim < best) {
+      best = sim;
+      best_entry = i;
+    }
   }
+  debugger("best similar: %.3f", best);
 
-  debugger("loading done: %d", count);
+  return best_entry;
+}
 
-  vector<decltype(dataset.begin())> replacement{};
+static Image mosaics(Image &img) {
+  MosaicDataset &dataset = mosaic_dataset();
+  if (dataset.images.empty())
+    return {};
 
-  auto best_entry = dataset.begin();
+  const int DWIDTH = MOSAIC_BLOCK;
+  const int DHEIGHT = DWIDTH;
+
+  int best_entry = 0;
 
   for (int x = 0; x < img.width - DWIDTH; x += DWIDTH) {
     for (int y = 0; y < img.height - DHEIGHT; y += DHEIGHT) {
@@ -307,28 +472,8 @@ static Image mosaics(Image &img) {
 
       Image cropped = img.crop(start, end);
 
-      double best = 100000000;
-      int i = 0;
-      for (auto entry = dataset.begin(); entry != dataset.end(); entry++) {
-
-        // float sim = structural_similarity(cropped, *entry);
-        // debugger("%s - similar: %.3f", alias[i++].c_str(), sim);
-
-        // if (sim > best) {
-        //   best = sim;
-        //   best_entry = entry;
-        // }
-
-        float sim = image_l1(cropped, *entry);
-        debugger("%s - similar: %.3f", alias[i++].c_str(), sim);
-
-        if (sim < best) {
-          best = sim;
-          best_entry = entry;
-        }
-      }
-      debugger("best similar: %.3f", best);
-      img.paint(*best_entry, start);
+      best_entry = best_mosaic_entry(cropped, best_entry);
+      img.paint(dataset.images[best_entry], start);
     }
   }
 
@@ -0,0 +1,207 @@
+/**
+ *
+ * @file erode, dilate, open and close with rectangular structuring elements.
+ *
+ * Uses the van Herk / Gil-Werman algorithm: the signal is cut into blocks of
+ * the window length k, a running min (max) is taken forwards and backwards
+ * inside each block, and every window is the min (max) of one backward and
+ * one forward value. That is three comparisons per pixel whatever k is.
+ *
+ * The rectangle is separated into a row pass and a column pass. The column
+ * pass applies the recurrence to whole rows at once, so its inner loops are
+ * element-wise byte min/max over contiguous memory, which compilers turn
+ * into packed SIMD min/max. Rows (row pass) and column strips (column pass)
+ * are split over worker threads.
+ */
+
+#if !defined(__MORPHOLOGY_H__)
+#define __MORPHOLOGY_H__
+
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+namespace Morphology {
+
+struct MinOp {
+  static constexpr GLubyte identity = 255;
+  static GLubyte apply(GLubyte a, GLubyte b) { return a < b ? a : b; }
+};
+
+struct MaxOp {
+  static constexpr GLubyte identity = 0;
+  static GLubyte apply(GLubyte a, GLubyte b) { return a > b ? a : b; }
+};
+
+/**
+ * @brief vHGW over one channel of a row.
+ *
+ * `src` holds n samples `stride` bytes apart; the window covers
+ * [x - before, x - before + k - 1] and samples outside the row are the
+ * identity of the operation. `g` and `h` are scratch of n + k - 1 bytes.
+ */
+template <typename Op>
+static void row_pass(const GLubyte *src, GLubyte *dst, int n, int stride,
+                     int k, int before, GLubyte *g, GLubyte *h) {
+  const int len = n + k - 1;
+  auto sample = [&](int i) -> GLubyte {
+    const int x = i - before;
+    return x >= 0 && x < n ? src[x * stride] : Op::identity;
+  };
+
+  for (int i = 0; i < len; i++)
+    g[i] = i % k == 0 ? sample(i) : Op::apply(g[i - 1], sample(i));
+  for (int i = len - 1; i >= 0; i--)
+    h[i] = (i % k == k - 1 || i == len - 1) ? sample(i)
+                                             : Op::apply(h[i + 1], sample(i));
+  for (int x = 0; x < n; x++)
+    dst[x * stride] = Op::apply(h[x], g[x + k - 1]);
+}
+
+/**
+ * @brief vHGW down the columns of rows [0, height) for bytes [c0, c1) of
+ * every row, each recurrence step being an element-wise op on a row segment.
+ */
+template <typename Op>
+static void column_pass(GLubyte *data, int row_bytes, int height, int k,
+                        int before, int c0, int c1) {
+  const int len = height + k - 1;
+  const int w = c1 - c0;
+  vector<GLubyte> g((size_t)len * w), h((size_t)len * w), pad(w, Op::identity);
+
+  auto sample = [&](int i) -> const GLubyte * {
+    const int y = i - before;
+    return y >= 0 && y < height ? data + (size_t)y * row_bytes + c0
+                                : pad.data();
+  };
+
+  for (int i = 0; i < len; i++) {
+    GLubyte *gi = g.data() + (size_t)i * w;
+    const GLubyte *s = sample(i);
+    if (i % k == 0) {
+      copy(s, s + w, gi);
+    } else {
+      const GLubyte *prev = gi - w;
+      for (int x = 0; x < w; x++)
+        gi[x] = Op::apply(prev[x], s[x]);
+    }
+  }
+  for (int i = len - 1; i >= 0; i--) {
+    GLubyte *hi = h.data() + (size_t)i * w;
+    const GLubyte *s = sample(i);
+    if (i % k == k - 1 || i == len - 1) {
+      copy(s, s + w, hi);
+    } else {
+      const GLubyte *next = hi + w;
+      for (int x = 0; x < w; x++)
+        hi[x] = Op::apply(next[x], s[x]);
+    }
+  }
+  for (int y = 0; y < height; y++) {
+    const GLubyte *hy = h.data() + (size_t)y * w;
+    const GLubyte *gy = g.data() + (size_t)(y + k - 1) * w;
+    GLubyte *dst = data + (size_t)y * row_bytes + c0;
+    for (int x = 0; x < w; x++)
+      dst[x] = Op::apply(hy[x], gy[x]);
+  }
+}
+
+/**
+ * @brief rectangular kw x kh filter of interleaved 8-bit data, in place.
+ *
+ * The window of a side k covers [x - k / 2, x + (k - 1) / 2], or its
+ * reflection [x - (k - 1) / 2, x + k / 2] when `reflected` is set. The two
+ * only differ for even k; the second pass of open and close must use the
+ * reflected element, or the result shifts by a pixel.
+ */
+template <typename Op>
+static void filter(GLubyte *data, int width, int height, int channels, int kw,
+                   int kh, bool reflected = false) {
+  if (width <= 0 || height <= 0)
+    return;
+  const int row_bytes = width * channels;
+  const int before_x = reflected ? (kw - 1) / 2 : kw / 2;
+  const int before_y = reflected ? (kh - 1) / 2 : kh / 2;
+
+  if (kw > 1) {
+    Parallel::parallel_for(0, height, [&](int s, int e) {
+      vector<GLubyte> row(row_bytes), g(width + kw - 1), h(width + kw - 1);
+      for (int y = s; y < e; y++) {
+        GLubyte *line = data + (size_t)y * row_bytes;
+        copy(line, line + row_bytes, row.begin());
+        for (int c = 0; c < channels; c++)
+          row_pass<Op>(row.data() + c, line + c, width, channels, kw,
+                       before_x, g.data(), h.data());
+      }
+    });
+  }
+
+  if (kh > 1) {
+    // strips narrow enough that the g / h scratch stays in cache
+    const int strip = 256;
+    const int strips = (row_bytes + strip - 1) / strip;
+    Parallel::parallel_each(0, strips, [&](int i) {
+      column_pass<Op>(data, row_bytes, height, kh, before_y, i * strip,
+                      min(row_bytes, (i + 1) * strip));
+    });
+  }
+}
+
+static Gray8 erode(const Gray8 &mask, int kw, int kh) {
+  Gray8 out = mask;
+  filter<MinOp>(out.data.data(), out.width, out.height, 1, kw, kh);
+  return out;
+}
+
+static Gray8 dilate(const Gray8 &mask, int kw, int kh) {
+  Gray8 out = mask;
+  filter<MaxOp>(out.data.data(), out.width, out.height, 1, kw, kh);
+  return out;
+}
+
+static Gray8 open(const Gray8 &mask, int kw, int kh) {
+  Gray8 out = erode(mask, kw, kh);
+  filter<MaxOp>(out.data.data(), out.width, out.height, 1, kw, kh, true);
+  return out;
+}
+
+static Gray8 close(const Gray8 &mask, int kw, int kh) {
+  Gray8 out = dilate(mask, kw, kh);
+  filter<MinOp>(out.data.data(), out.width, out.height, 1, kw, kh, true);
+  return out;
+}
+
+/**
+ * @brief per-channel erosion of an RGBA image (alpha included).
+ */
+static Image erode(const Image &img, int kw, int kh) {
+  Image out = img;
+  filter<MinOp>(out.bytes.data(), out.width, out.height, 4, kw, kh);
+  return out;
+}
+
+static Image dilate(const Image &img, int kw, int kh) {
+  Image out = img;
+  filter<MaxOp>(out.bytes.data(), out.width, out.height, 4, kw, kh);
+  return out;
+}
+
+static Image open(const Image &img, int kw, int kh) {
+  Image out = erode(img, kw, kh);
+  filter<MaxOp>(out.bytes.data(), out.width, out.height, 4, kw, kh, true);
+  return out;
+}
+
+static Image close(const Image &img, int kw, int kh) {
+  Image out = dilate(img, kw, kh);
+  filter<MinOp>(out.bytes.data(), out.width, out.height, 4, kw, kh, true);
+  return out;
+}
+
+} // namespace Morphology
+
+#endif // __MORPHOLOGY_H__
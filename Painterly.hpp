@@ -0,0 +1,160 @@
+/**
+ *
+ * @file gradient-guided automatic painterly rendering.
+ *
+ * The Sobel orientation field of the source is computed once; strokes are
+ * then placed tile by tile, each aligned with the local edge direction and
+ * coloured from the source, and rasterised with the software rasteriser.
+ */
+
+#if !defined(__PAINTERLY_H__)
+#define __PAINTERLY_H__
+
+#include "BilateralGrid.hpp"
+#include "Image.hpp"
+#include "ImageUtils.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include "Random.hpp"
+#include "Rasterizer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+namespace Painterly {
+
+struct PaintOptions {
+  int strokes = 200000;       // total strokes over the whole image
+  float stroke_length = 12;   // pixels, before jitter
+  float stroke_width = 3;     // pixels
+  float length_jitter = 0.5;  // length varies in [1 - j, 1 + j] * length
+  float angle_jitter = 0.15;  // radian
+  float min_gradient = 8;     // below this the orientation is random
+  GLubyte alpha = 200;
+  unsigned seed = 4411;
+  int tile_size = 64;
+  int batch_strokes = 65536; // strokes generated per rasterised batch
+  // edge-preserving smoothing of the source before the orientation field is
+  // taken; a spatial sigma of 0 disables it
+  float smooth_spatial = 0;
+  float smooth_range = 24;
+};
+
+class Painter {
+public:
+  /**
+   * @brief precompute the orientation field of the source.
+   */
+  Painter(Image &source, const PaintOptions &options = {})
+      : src{source}, opts{options} {
+    Plane<float> grey;
+    if (opts.smooth_spatial > 0) {
+      Image smooth = BilateralGrid::filter(src, opts.smooth_spatial,
+                                           opts.smooth_range);
+      grey = ImageUtils::grey_plane(smooth);
+    } else {
+      grey = ImageUtils::grey_plane(src);
+    }
+    ImageUtils::sobel_field(grey, magnitude, angle);
+  }
+
+  /**
+   * @brief paint every stroke onto the canvas.
+   *
+   * The canvas must have the size of the source. Strokes are emitted in
+   * rounds: each round every tile appends its share to its own batch, then
+   * the round is rasterised, so memory stays bounded and later rounds layer
+   * over the whole image rather than tile by tile.
+   */
+  void paint(Image &canvas) {
+    const int ts = opts.tile_size;
+    const int tiles_x = (src.width + ts - 1) / ts;
+    const int tiles_y = (src.height + ts - 1) / ts;
+    const int num_tiles = tiles_x * tiles_y;
+    if (num_tiles == 0 || opts.strokes <= 0)
+      return;
+
+    // per-tile stroke quota proportional to tile area
+    vector<int> quota(num_tiles);
+    const double per_pixel = (double)opts.strokes / (src.width * src.height);
+    for (int t = 0; t < num_tiles; t++) {
+      const int tw = min(ts, src.width - (t % tiles_x) * ts);
+      const int th = min(ts, src.height - (t / tiles_x) * ts);
+      quota[t] = (int)lround(per_pixel * tw * th);
+    }
+
+    vector<Rng> rngs;
+    for (int t = 0; t < num_tiles; t++)
+      rngs.emplace_back(opts.seed, t);
+
+    const int batch = max(1, opts.batch_strokes);
+    const int rounds = max(1, (opts.strokes + batch - 1) / batch);
+    vector<Rasterizer::Batch> batches(num_tiles, Rasterizer::Batch{GL_LINES});
+    for (auto &b : batches)
+      b.set_line_width(opts.stroke_width);
+
+    for (int r = 0; r < rounds; r++) {
+      Parallel::parallel_each(0, num_tiles, [&](int t) {
+        const int from = (int)((long long)quota[t] * r / rounds);
+        const int to = (int)((long long)quota[t] * (r + 1) / rounds);
+        batches[t].clear();
+        for (int i = from; i < to; i++)
+          add_stroke(batches[t], rngs[t], t % tiles_x, t / tiles_x);
+      });
+      Rasterizer::draw(canvas, batches);
+    }
+  }
+
+  Plane<float> magnitude;
+  Plane<float> angle;
+
+private:
+  Image &src;
+  PaintOptions opts;
+
+  void add_stroke(Rasterizer::Batch &batch, Rng &rng, int tx, int ty) {
+    const int ts = opts.tile_size;
+    const int x0 = tx * ts;
+    const int y0 = ty * ts;
+    const int x = x0 + rng.irand(min(ts, src.width - x0));
+    const int y = y0 + rng.irand(min(ts, src.height - y0));
+
+    // strokes follow the edge, i.e. perpendicular to the gradient
+    float rad;
+    if (magnitude(y, x) < opts.min_gradient)
+      rad = rng.frand() * 2 * 3.1415926F;
+    else
+      rad = angle(y, x) + 3.1415926F / 2 +
+            (rng.frand() * 2 - 1) * opts.angle_jitter;
+
+    const float len = opts.stroke_length *
+                      (1 + (rng.frand() * 2 - 1) * opts.length_jitter) / 2;
+    const float dx = cos(rad) * len;
+    const float dy = sin(rad) * len;
+
+    auto color = src(y, x);
+    GLubyte rgba[4] = {get<0>(color), get<1>(color), get<2>(color),
+                       opts.alpha};
+    batch.set_color(rgba);
+    batch.set_point(x + 0.5 - dx, y + 0.5 - dy);
+    batch.set_point(x + 0.5 + dx, y + 0.5 + dy);
+  }
+};
+
+/**
+ * @brief auto-paint the source onto a blank canvas of the same size.
+ */
+static Image auto_paint(Image &source, const PaintOptions &options = {}) {
+  Image canvas = source;
+  fill(canvas.bytes.begin(), canvas.bytes.end(), 255);
+
+  Painter painter{source, options};
+  painter.paint(canvas);
+  return canvas;
+}
+
+} // namespace Painterly
+
+#endif // __PAINTERLY_H__
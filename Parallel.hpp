@@ -0,0 +1,81 @@
+#if !defined(__PARALLEL_H__)
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace Parallel {
+
+static int worker_count() {
+  const int n = (int)thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+/**
+ * @brief Split [begin, end) into contiguous chunks and run them on worker
+ * threads.
+ *
+ * The handler receives a half-open sub-range. Ranges shorter than `grain` per
+ * worker run on the calling thread, so small images don't pay for thread
+ * creation.
+ */
+static void parallel_for(int begin, int end,
+                         function<void(int, int)> handler, int grain = 1) {
+  const int total = end - begin;
+  if (total <= 0)
+    return;
+
+  const int workers =
+      max(1, min(worker_count(), total / max(grain, 1)));
+  if (workers == 1) {
+    handler(begin, end);
+    return;
+  }
+
+  vector<thread> pool;
+  const int chunk = (total + workers - 1) / workers;
+  for (int s = begin + chunk; s < end; s += chunk) {
+    pool.emplace_back(handler, s, min(s + chunk, end));
+  }
+  handler(begin, min(begin + chunk, end));
+
+  for (auto &t : pool)
+    t.join();
+}
+
+/**
+ * @brief Run handler(i) for every i in [begin, end).
+ *
+ * Indices are handed out one at a time from a shared counter, so this suits
+ * work items of uneven cost (e.g. screen tiles with different primitive
+ * counts).
+ */
+static void parallel_each(int begin, int end, function<void(int)> handler) {
+  const int total = end - begin;
+  if (total <= 0)
+    return;
+
+  atomic<int> next{begin};
+  auto worker = [&]() {
+    for (int i = next++; i < end; i = next++)
+      handler(i);
+  };
+
+  const int workers = min(worker_count(), total);
+  vector<thread> pool;
+  for (int w = 1; w < workers; w++)
+    pool.emplace_back(worker);
+  worker();
+
+  for (auto &t : pool)
+    t.join();
+}
+
+} // namespace Parallel
+
+#endif // __PARALLEL_H__
@@ -0,0 +1,50 @@
+#if !defined(__PLANE_H__)
+#define __PLANE_H__
+
+#include "Image.hpp"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief A single-channel 2D buffer, indexed (y, x) like `Image`.
+ *
+ * Used for intermediate per-pixel data (grey levels, gradient fields, masks)
+ * that doesn't need four interleaved channels.
+ */
+template <typename T> class Plane {
+public:
+  vector<T> data;
+
+  int width;
+  int height;
+  Plane() : Plane{0, 0} {}
+  Plane(int w, int h, T fill = T{})
+      : data((size_t)w * h, fill), width{w}, height{h} {}
+
+  T &operator()(int y, int x) { return data[(size_t)y * width + x]; }
+  const T &operator()(int y, int x) const {
+    return data[(size_t)y * width + x];
+  }
+
+  T *row(int y) { return data.data() + (size_t)y * width; }
+  const T *row(int y) const { return data.data() + (size_t)y * width; }
+
+  bool valid_point(int y, int x) const {
+    return x >= 0 && y >= 0 && x < width && y < height;
+  }
+
+  /**
+   * @brief read with the coordinates clamped to the border.
+   */
+  const T &clamped(int y, int x) const {
+    y = min(max(y, 0), height - 1);
+    x = min(max(x, 0), width - 1);
+    return (*this)(y, x);
+  }
+};
+
+typedef Plane<GLubyte> Gray8;
+
+#endif // __PLANE_H__
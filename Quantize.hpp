@@ -0,0 +1,415 @@
+/**
+ *
+ * @file colour quantisation: palette design and palette mapping.
+ *
+ * Palettes are designed on a colour histogram of 32 x 32 x 32 cells (5 bits
+ * per channel) filled from a sample of the pixels, each cell remembering the
+ * mean colour of its pixels. Median cut and k-means then work on at most
+ * 32768 weighted colours, whatever the image size.
+ *
+ * Pixels are mapped through a lookup cube of the same resolution holding the
+ * nearest palette entry of every cell, so mapping is one table read per
+ * pixel. Floyd-Steinberg dithering is pipelined over rows: a row only needs
+ * its predecessor to be two pixels ahead of it, so many rows are in flight
+ * at once, each on its own worker, staggered like a wavefront.
+ */
+
+#if !defined(__QUANTIZE_H__)
+#define __QUANTIZE_H__
+
+#include "Histogram.hpp"
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include "Random.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace Quantize {
+
+typedef array<GLubyte, 3> Color;
+typedef vector<Color> Palette;
+
+enum Method { MEDIAN_CUT, KMEANS };
+
+static const int CUBE_BITS = 5;
+static const int CUBE_SIDE = 1 << CUBE_BITS;
+static const int CUBE_CELLS = CUBE_SIDE * CUBE_SIDE * CUBE_SIDE;
+
+static inline int cell_of(int r, int g, int b) {
+  const int shift = 8 - CUBE_BITS;
+  return ((r >> shift) << (2 * CUBE_BITS)) | ((g >> shift) << CUBE_BITS) |
+         (b >> shift);
+}
+
+struct ColorHistogram {
+  vector<uint32_t> count;
+  vector<uint64_t> sum; // r, g, b per cell
+
+  ColorHistogram() : count(CUBE_CELLS, 0), sum(3 * CUBE_CELLS, 0) {}
+
+  ColorHistogram &operator+=(const ColorHistogram &other) {
+    for (int i = 0; i < CUBE_CELLS; i++)
+      count[i] += other.count[i];
+    for (int i = 0; i < 3 * CUBE_CELLS; i++)
+      sum[i] += other.sum[i];
+    return *this;
+  }
+};
+
+/**
+ * @brief histogram of every step-th pixel, with step chosen so that at most
+ * `max_samples` pixels are read.
+ */
+static ColorHistogram sample_histogram(Image &img, int max_samples = 1 << 20) {
+  const size_t pixels = (size_t)img.width * img.height;
+  const size_t step = max<size_t>(1, pixels / max(max_samples, 1));
+  return Histogram::reduce_rows<ColorHistogram>(
+      img.height, [&](ColorHistogram &h, int s, int e) {
+        const size_t begin = (size_t)s * img.width, end = (size_t)e * img.width;
+        for (size_t i = (begin + step - 1) / step * step; i < end; i += step) {
+          const GLubyte *p = img.bytes.data() + 4 * i;
+          const int c = cell_of(p[0], p[1], p[2]);
+          h.count[c]++;
+          h.sum[3 * c] += p[0];
+          h.sum[3 * c + 1] += p[1];
+          h.sum[3 * c + 2] += p[2];
+        }
+      });
+}
+
+/**
+ * @brief an occupied histogram cell: its mean colour and pixel count.
+ */
+struct Entry {
+  float c[3];
+  float weight;
+};
+
+static vector<Entry> entries_of(const ColorHistogram &h) {
+  vector<Entry> out;
+  for (int i = 0; i < CUBE_CELLS; i++) {
+    if (h.count[i] == 0)
+      continue;
+    const float n = (float)h.count[i];
+    out.push_back(Entry{{h.sum[3 * i] / n, h.sum[3 * i + 1] / n,
+                         h.sum[3 * i + 2] / n},
+                        n});
+  }
+  return out;
+}
+
+static Color to_color(const double c[3]) {
+  Color out;
+  for (int k = 0; k < 3; k++)
+    out[k] = (GLubyte)min(255.0, max(0.0, c[k] + 0.5));
+  return out;
+}
+
+/**
+ * @brief Heckbert's median cut: repeatedly split the box with the largest
+ * population x extent across its longest side at the weighted median, then
+ * take the weighted mean of every box.
+ */
+static Palette median_cut(const ColorHistogram &h, int colors) {
+  if (colors <= 0)
+    return {};
+  vector<Entry> entries = entries_of(h);
+  struct Box {
+    int begin, end; // range of `entries`
+    int axis;
+    float score;
+  };
+
+  auto make_box = [&](int begin, int end) {
+    float lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0}, weight = 0;
+    for (int i = begin; i < end; i++) {
+      for (int k = 0; k < 3; k++) {
+        lo[k] = min(lo[k], entries[i].c[k]);
+        hi[k] = max(hi[k], entries[i].c[k]);
+      }
+      weight += entries[i].weight;
+    }
+    int axis = 0;
+    for (int k = 1; k < 3; k++)
+      if (hi[k] - lo[k] > hi[axis] - lo[axis])
+        axis = k;
+    // a box of one entry can't be split
+    const float score = end - begin > 1 ? weight * (hi[axis] - lo[axis]) : -1;
+    return Box{begin, end, axis, score};
+  };
+
+  vector<Box> boxes;
+  if (!entries.empty())
+    boxes.push_back(make_box(0, (int)entries.size()));
+
+  while ((int)boxes.size() < colors) {
+    auto best = max_element(
+        boxes.begin(), boxes.end(),
+        [](const Box &a, const Box &b) { return a.score < b.score; });
+    if (best == boxes.end() || best->score < 0)
+      break;
+
+    const Box box = *best;
+    sort(entries.begin() + box.begin, entries.begin() + box.end,
+         [&](const Entry &a, const Entry &b) {
+           return a.c[box.axis] < b.c[box.axis];
+         });
+    float total = 0;
+    for (int i = box.begin; i < box.end; i++)
+      total += entries[i].weight;
+    float acc = 0;
+    int split = box.begin + 1;
+    for (int i = box.begin; i < box.end - 1; i++) {
+      acc += entries[i].weight;
+      split = i + 1;
+      if (acc >= total / 2)
+        break;
+    }
+
+    *best = make_box(box.begin, split);
+    boxes.push_back(make_box(split, box.end));
+  }
+
+  Palette palette;
+  for (auto &box : boxes) {
+    double sum[3] = {0, 0, 0}, weight = 0;
+    for (int i = box.begin; i < box.end; i++) {
+      for (int k = 0; k < 3; k++)
+        sum[k] += (double)entries[i].c[k] * entries[i].weight;
+      weight += entries[i].weight;
+    }
+    for (int k = 0; k < 3; k++)
+      sum[k] /= weight;
+    palette.push_back(to_color(sum));
+  }
+  return palette;
+}
+
+static inline float distance2(const float a[3], const float b[3]) {
+  const float dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+  return dr * dr + dg * dg + db * db;
+}
+
+/**
+ * @brief weighted k-means over the histogram entries, seeded with k-means++
+ * (each new centre drawn with probability weight x squared distance to the
+ * nearest chosen one).
+ */
+static Palette kmeans(const ColorHistogram &h, int colors, int iterations = 16,
+                      unsigned seed = 7919) {
+  const vector<Entry> entries = entries_of(h);
+  const int n = (int)entries.size();
+  colors = min(colors, n);
+  if (colors <= 0)
+    return {};
+
+  Rng rng{seed};
+  auto draw = [&](const vector<double> &weight) {
+    double total = 0;
+    for (double w : weight)
+      total += w;
+    double target = rng.frand() * total;
+    for (int i = 0; i < n; i++) {
+      target -= weight[i];
+      if (target < 0)
+        return i;
+    }
+    return n - 1;
+  };
+
+  vector<array<float, 3>> centres;
+  vector<double> nearest(n);
+  for (int i = 0; i < n; i++)
+    nearest[i] = entries[i].weight;
+  while ((int)centres.size() < colors) {
+    const Entry &e = entries[draw(nearest)];
+    centres.push_back({e.c[0], e.c[1], e.c[2]});
+    for (int i = 0; i < n; i++) {
+      const double d = distance2(entries[i].c, centres.back().data());
+      nearest[i] = centres.size() == 1
+                       ? entries[i].weight * d
+                       : min(nearest[i], entries[i].weight * d);
+    }
+  }
+
+  vector<int> assignment(n, -1);
+  for (int it = 0; it < iterations; it++) {
+    atomic<bool> moved{false};
+    Parallel::parallel_for(0, n, [&](int s, int e) {
+      for (int i = s; i < e; i++) {
+        int best = 0;
+        float best_d = distance2(entries[i].c, centres[0].data());
+        for (int c = 1; c < colors; c++) {
+          const float d = distance2(entries[i].c, centres[c].data());
+          if (d < best_d) {
+            best_d = d;
+            best = c;
+          }
+        }
+        if (assignment[i] != best) {
+          assignment[i] = best;
+          moved = true;
+        }
+      }
+    }, 1024);
+    if (!moved)
+      break;
+
+    vector<array<double, 4>> sum(colors, {0, 0, 0, 0});
+    for (int i = 0; i < n; i++) {
+      auto &s = sum[assignment[i]];
+      for (int k = 0; k < 3; k++)
+        s[k] += (double)entries[i].c[k] * entries[i].weight;
+      s[3] += entries[i].weight;
+    }
+    // an empty cluster keeps its centre
+    for (int c = 0; c < colors; c++)
+      if (sum[c][3] > 0)
+        for (int k = 0; k < 3; k++)
+          centres[c][k] = (float)(sum[c][k] / sum[c][3]);
+  }
+
+  Palette palette;
+  for (auto &c : centres) {
+    const double v[3] = {c[0], c[1], c[2]};
+    palette.push_back(to_color(v));
+  }
+  return palette;
+}
+
+/**
+ * @brief nearest palette entry for every cell of the colour cube, taken at
+ * the cell centre.
+ */
+class Cube {
+public:
+  explicit Cube(const Palette &palette) : index(CUBE_CELLS, 0) {
+    const int half = 1 << (7 - CUBE_BITS);
+    Parallel::parallel_for(0, CUBE_CELLS, [&](int s, int e) {
+      for (int i = s; i < e; i++) {
+        const int shift = 8 - CUBE_BITS;
+        const int r = ((i >> (2 * CUBE_BITS)) << shift) + half;
+        const int g = (((i >> CUBE_BITS) & (CUBE_SIDE - 1)) << shift) + half;
+        const int b = ((i & (CUBE_SIDE - 1)) << shift) + half;
+        int best = 0, best_d = 1 << 30;
+        for (int p = 0; p < (int)palette.size(); p++) {
+          const int dr = r - palette[p][0], dg = g - palette[p][1],
+                    db = b - palette[p][2];
+          const int d = dr * dr + dg * dg + db * db;
+          if (d < best_d) {
+            best_d = d;
+            best = p;
+          }
+        }
+        index[i] = (uint16_t)best;
+      }
+    }, 256);
+  }
+
+  int nearest(int r, int g, int b) const { return index[cell_of(r, g, b)]; }
+
+private:
+  vector<uint16_t> index;
+};
+
+/**
+ * @brief Floyd-Steinberg error diffusion, rows pipelined across workers.
+ *
+ * The error pushed into row y + 1 lives in one of two row buffers; a row
+ * reads (and clears) its buffer just ahead of where the next-but-one row
+ * writes into it again, which the two-pixel lag guarantees. Every sample
+ * receives its contributions in a fixed order, so the output does not depend
+ * on scheduling.
+ */
+static void dither(Image &img, const Palette &palette, const Cube &cube) {
+  const int w = img.width, h = img.height;
+  vector<float> error[2] = {vector<float>(3 * (w + 2), 0.0F),
+                            vector<float>(3 * (w + 2), 0.0F)};
+  vector<atomic<int>> progress(h);
+  for (auto &p : progress)
+    p = 0;
+
+  const int publish = 32; // columns between progress updates
+  Parallel::parallel_each(0, h, [&](int y) {
+    // row y's incoming error, and the one it writes for row y + 1; index
+    // x + 1 holds column x, and the cells for columns -1 and w are never read
+    float *in = error[y & 1].data();
+    float *out = error[(y + 1) & 1].data();
+    float carry[3] = {0, 0, 0};
+    GLubyte *p = img.bytes.data() + 4 * (size_t)y * w;
+
+    for (int x = 0; x < w; x++, p += 4) {
+      if (y > 0 && (x % publish == 0)) {
+        const int need = min(w, x + publish + 1);
+        while (progress[y - 1].load(memory_order_acquire) < need)
+          this_thread::yield();
+      }
+
+      float v[3];
+      int q[3];
+      for (int k = 0; k < 3; k++) {
+        v[k] = p[k] + carry[k] + in[3 * (x + 1) + k];
+        in[3 * (x + 1) + k] = 0;
+        q[k] = (int)min(255.0F, max(0.0F, v[k] + 0.5F));
+      }
+      const Color &c = palette[cube.nearest(q[0], q[1], q[2])];
+      for (int k = 0; k < 3; k++) {
+        const float e = v[k] - c[k];
+        p[k] = c[k];
+        carry[k] = e * (7.0F / 16);
+        out[3 * x + k] += e * (3.0F / 16);
+        out[3 * (x + 1) + k] += e * (5.0F / 16);
+        out[3 * (x + 2) + k] += e * (1.0F / 16);
+      }
+
+      if ((x + 1) % publish == 0)
+        progress[y].store(x + 1, memory_order_release);
+    }
+    progress[y].store(w, memory_order_release);
+  });
+}
+
+/**
+ * @brief every pixel replaced by a palette colour (alpha kept).
+ */
+static Image apply(Image &img, const Palette &palette, bool use_dither) {
+  Image out = img;
+  if (palette.empty())
+    return out;
+  const Cube cube{palette};
+
+  if (use_dither) {
+    dither(out, palette, cube);
+    return out;
+  }
+
+  Parallel::parallel_for(0, out.height, [&](int s, int e) {
+    GLubyte *p = out.bytes.data() + 4 * (size_t)s * out.width;
+    GLubyte *end = out.bytes.data() + 4 * (size_t)e * out.width;
+    for (; p < end; p += 4) {
+      const Color &c = palette[cube.nearest(p[0], p[1], p[2])];
+      p[0] = c[0];
+      p[1] = c[1];
+      p[2] = c[2];
+    }
+  });
+  return out;
+}
+
+/**
+ * @brief design a palette of at most `colors` entries for the image.
+ */
+static Palette palette(Image &img, int colors, Method method = MEDIAN_CUT) {
+  const ColorHistogram h = sample_histogram(img);
+  return method == KMEANS ? kmeans(h, colors) : median_cut(h, colors);
+}
+
+} // namespace Quantize
+
+#endif // __QUANTIZE_H__
@@ -0,0 +1,37 @@
+#if !defined(__RANDOM_H__)
+#define __RANDOM_H__
+
+#include <cstdint>
+
+/**
+ * @brief Small deterministic random stream (splitmix64).
+ *
+ * Unlike `frand`/`irand`, which share the global `rand()` state, every `Rng`
+ * is independent, so each worker thread or tile can own one and the output
+ * doesn't depend on scheduling.
+ */
+class Rng {
+public:
+  Rng(uint64_t seed, uint64_t stream = 0)
+      : state{seed ^ (stream * 0xD1B54A32D192ED03ULL)} {
+    next();
+  }
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  // uniform in [0, 1)
+  float frand() { return (next() >> 40) * (1.0F / (1 << 24)); }
+
+  // uniform in [0, max)
+  int irand(int max) { return (int)(((next() >> 32) * (uint64_t)max) >> 32); }
+
+private:
+  uint64_t state;
+};
+
+#endif // __RANDOM_H__
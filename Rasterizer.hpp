@@ -0,0 +1,441 @@
+/**
+ *
+ * @file CPU software rasteriser for the GLHelper drawing primitives.
+ *
+ * Mirrors `GLHelper::gl_draw_shape` (every GL 1.x begin/end mode, with
+ * per-vertex RGBA, blended with GL_SRC_ALPHA / GL_ONE_MINUS_SRC_ALPHA) but
+ * renders straight into an `Image`, so no GL context is needed. Points and
+ * lines are the aliased kind: square points and wide lines drawn as quads.
+ *
+ * Primitives are binned into fixed-size screen tiles and each tile is
+ * rasterised by one worker thread, in submission order, so the result is
+ * deterministic and identical to a single-threaded draw.
+ */
+
+#if !defined(__RASTERIZER_H__)
+#define __RASTERIZER_H__
+
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include "gl_helper.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+namespace Rasterizer {
+
+struct Vertex {
+  float x, y;
+  GLubyte color[4];
+};
+
+/**
+ * @brief A triangle or an axis-aligned rectangle in image coordinates.
+ *
+ * Rectangles come from GL_POINTS and are always flat-shaded; triangles carry
+ * one colour per vertex.
+ */
+struct Primitive {
+  bool rect;
+  float x[3], y[3];
+  GLubyte color[3][4];
+  int min_x, min_y, max_x, max_y; // inclusive pixel bounds
+};
+
+class Batch {
+public:
+  Batch(int drawing_mode = GL_POINTS) : mode{drawing_mode} {}
+
+  void set_color(const GLubyte *c) {
+    color[0] = c[0];
+    color[1] = c[1];
+    color[2] = c[2];
+    color[3] = c[3];
+  }
+
+  void set_color(const RGBA &rgba) {
+    color[0] = get<0>(rgba);
+    color[1] = get<1>(rgba);
+    color[2] = get<2>(rgba);
+    color[3] = get<3>(rgba);
+  }
+
+  void set_point(double x, double y) {
+    Vertex v{(float)x, (float)y, {color[0], color[1], color[2], color[3]}};
+    vertices.push_back(v);
+  }
+
+  void set_point(const Point &p) { set_point(p.x, p.y); }
+
+  void set_point_size(float size) { point_size = size; }
+  void set_line_width(float width) { line_width = width; }
+
+  void clear() { vertices.clear(); }
+  size_t size() const { return vertices.size(); }
+
+  /**
+   * @brief Convert the recorded vertices into primitives, following the
+   * assembly rules of the GL drawing mode.
+   */
+  void assemble(vector<Primitive> &out) const {
+    const size_t n = vertices.size();
+    switch (mode) {
+    case GL_POINTS:
+      for (size_t i = 0; i < n; i++)
+        emit_point(out, vertices[i]);
+      break;
+    case GL_LINES:
+      for (size_t i = 0; i + 1 < n; i += 2)
+        emit_line(out, vertices[i], vertices[i + 1]);
+      break;
+    case GL_LINE_STRIP:
+    case GL_LINE_LOOP:
+      for (size_t i = 0; i + 1 < n; i++)
+        emit_line(out, vertices[i], vertices[i + 1]);
+      if (mode == GL_LINE_LOOP && n > 2)
+        emit_line(out, vertices[n - 1], vertices[0]);
+      break;
+    case GL_TRIANGLES:
+      for (size_t i = 0; i + 2 < n; i += 3)
+        emit_triangle(out, vertices[i], vertices[i + 1], vertices[i + 2]);
+      break;
+    case GL_TRIANGLE_STRIP:
+      for (size_t i = 0; i + 2 < n; i++)
+        emit_triangle(out, vertices[i], vertices[i + 1], vertices[i + 2]);
+      break;
+    case GL_TRIANGLE_FAN:
+    case GL_POLYGON: // convex, so a fan
+      for (size_t i = 1; i + 1 < n; i++)
+        emit_triangle(out, vertices[0], vertices[i], vertices[i + 1]);
+      break;
+    case GL_QUADS:
+      for (size_t i = 0; i + 3 < n; i += 4) {
+        emit_triangle(out, vertices[i], vertices[i + 1], vertices[i + 2]);
+        emit_triangle(out, vertices[i], vertices[i + 2], vertices[i + 3]);
+      }
+      break;
+    case GL_QUAD_STRIP:
+      // quad i is vertices 2i, 2i + 1, 2i + 3, 2i + 2
+      for (size_t i = 0; i + 3 < n; i += 2) {
+        emit_triangle(out, vertices[i], vertices[i + 1], vertices[i + 3]);
+        emit_triangle(out, vertices[i], vertices[i + 3], vertices[i + 2]);
+      }
+      break;
+    default:
+      debugger("Rasterizer: unsupported drawing mode %d", mode);
+      break;
+    }
+  }
+
+  int mode;
+  float point_size = 1;
+  float line_width = 1;
+  vector<Vertex> vertices;
+
+private:
+  GLubyte color[4] = {255, 255, 255, 255};
+
+  static void set_bounds(Primitive &p, float x0, float y0, float x1,
+                         float y1) {
+    // pixel (x, y) is covered when its centre (x + 0.5, y + 0.5) is inside
+    p.min_x = (int)ceil(x0 - 0.5f);
+    p.min_y = (int)ceil(y0 - 0.5f);
+    p.max_x = (int)ceil(x1 - 0.5f) - 1;
+    p.max_y = (int)ceil(y1 - 0.5f) - 1;
+  }
+
+  /**
+   * @brief the GL rule for aliased points: the size is rounded to a whole
+   * number of pixels, and the centre snaps to a pixel centre for odd sizes
+   * (to a pixel corner for even ones), so a size-1 point at (5, 5) lights
+   * exactly pixel (5, 5).
+   */
+  void emit_point(vector<Primitive> &out, const Vertex &v) const {
+    Primitive p;
+    p.rect = true;
+    const int size = max(1, (int)lround(point_size));
+    const float half = size / 2.0f;
+    const float cx = size % 2 ? floor(v.x) + 0.5f : floor(v.x + 0.5f);
+    const float cy = size % 2 ? floor(v.y) + 0.5f : floor(v.y + 0.5f);
+    p.x[0] = cx - half;
+    p.y[0] = cy - half;
+    p.x[1] = cx + half;
+    p.y[1] = cy + half;
+    copy(v.color, v.color + 4, p.color[0]);
+    set_bounds(p, p.x[0], p.y[0], p.x[1], p.y[1]);
+    if (p.min_x <= p.max_x && p.min_y <= p.max_y)
+      out.push_back(p);
+  }
+
+  void emit_line(vector<Primitive> &out, const Vertex &a,
+                 const Vertex &b) const {
+    const float dx = b.x - a.x;
+    const float dy = b.y - a.y;
+    const float len = sqrt(dx * dx + dy * dy);
+    if (len == 0)
+      return;
+
+    // expand the segment into a quad of the current line width
+    const float nx = -dy / len * line_width / 2;
+    const float ny = dx / len * line_width / 2;
+    Vertex a0 = a, a1 = a, b0 = b, b1 = b;
+    a0.x += nx, a0.y += ny;
+    a1.x -= nx, a1.y -= ny;
+    b0.x += nx, b0.y += ny;
+    b1.x -= nx, b1.y -= ny;
+    emit_triangle(out, a0, a1, b1);
+    emit_triangle(out, a0, b1, b0);
+  }
+
+  static void emit_triangle(vector<Primitive> &out, const Vertex &a,
+                            const Vertex &b, const Vertex &c) {
+    const float area = (b.x - a.x) * (c.y - a.y) - (c.x - a.x) * (b.y - a.y);
+    if (area == 0)
+      return;
+
+    // store counter-clockwise so every edge function is positive inside
+    const Vertex *v[3] = {&a, &b, &c};
+    if (area < 0)
+      swap(v[1], v[2]);
+
+    Primitive p;
+    p.rect = false;
+    for (int i = 0; i < 3; i++) {
+      p.x[i] = v[i]->x;
+      p.y[i] = v[i]->y;
+      copy(v[i]->color, v[i]->color + 4, p.color[i]);
+    }
+    set_bounds(p, min({p.x[0], p.x[1], p.x[2]}), min({p.y[0], p.y[1], p.y[2]}),
+               max({p.x[0], p.x[1], p.x[2]}), max({p.y[0], p.y[1], p.y[2]}));
+    // ceil(max - 0.5) - 1 excludes a vertex sitting exactly on a centre;
+    // widen by one and let the edge functions decide
+    p.max_x++;
+    p.max_y++;
+    out.push_back(p);
+  }
+};
+
+/**
+ * @brief exact (v / 255) rounded, for v in [0, 255 * 255].
+ */
+static inline int div255(int v) {
+  v += 128;
+  return (v + (v >> 8)) >> 8;
+}
+
+/**
+ * @brief Blend a constant colour over a run of `count` RGBA pixels.
+ *
+ * The loop runs over bytes with no data-dependent branches so the compiler
+ * vectorises it.
+ */
+static void fill_span(GLubyte *dst, int count, const GLubyte *color) {
+  const int a = color[3];
+  const int inv = 255 - a;
+  const int pre[4] = {color[0] * a, color[1] * a, color[2] * a, color[3] * a};
+
+  if (a == 255) {
+    for (int i = 0; i < count * 4; i++)
+      dst[i] = color[i & 3];
+    return;
+  }
+  if (a == 0)
+    return;
+
+  for (int i = 0; i < count * 4; i++)
+    dst[i] = (GLubyte)div255(pre[i & 3] + dst[i] * inv);
+}
+
+/**
+ * @brief Blend a linearly varying colour over a run of RGBA pixels.
+ *
+ * `c` and `dc` are the 16.16 fixed-point colour at the first pixel and its
+ * per-pixel increment.
+ */
+static void fill_span_gradient(GLubyte *dst, int count, const long long *c,
+                               const long long *dc) {
+  long long cur[4] = {c[0], c[1], c[2], c[3]};
+  for (int i = 0; i < count; i++, dst += 4) {
+    int s[4];
+    for (int k = 0; k < 4; k++) {
+      s[k] = (int)min(255LL, max(0LL, (cur[k] + 0x8000) >> 16));
+      cur[k] += dc[k];
+    }
+    const int inv = 255 - s[3];
+    for (int k = 0; k < 4; k++)
+      dst[k] = (GLubyte)div255(s[k] * s[3] + dst[k] * inv);
+  }
+}
+
+static void draw_rect(Image &canvas, const Primitive &p, int x0, int y0,
+                      int x1, int y1) {
+  x0 = max(x0, p.min_x);
+  y0 = max(y0, p.min_y);
+  x1 = min(x1, p.max_x);
+  y1 = min(y1, p.max_y);
+  for (int y = y0; y <= y1; y++) {
+    GLubyte *row = canvas.bytes.data() + 4 * (y * canvas.width + x0);
+    fill_span(row, x1 - x0 + 1, p.color[0]);
+  }
+}
+
+static void draw_triangle(Image &canvas, const Primitive &p, int x0, int y0,
+                          int x1, int y1) {
+  // edge i is opposite vertex i: E(x, y) = A x + B y + C
+  float A[3], B[3], C[3];
+  for (int i = 0; i < 3; i++) {
+    const int s = (i + 1) % 3, e = (i + 2) % 3;
+    A[i] = p.y[s] - p.y[e];
+    B[i] = p.x[e] - p.x[s];
+    C[i] = p.x[s] * p.y[e] - p.x[e] * p.y[s];
+  }
+  const float area = C[0] + C[1] + C[2];
+
+  // colour is affine in (x, y); derive its plane from the barycentrics
+  bool flat = true;
+  float cx[4], cy[4], c0[4];
+  for (int k = 0; k < 4; k++) {
+    cx[k] = cy[k] = c0[k] = 0;
+    for (int i = 0; i < 3; i++) {
+      cx[k] += p.color[i][k] * A[i] / area;
+      cy[k] += p.color[i][k] * B[i] / area;
+      c0[k] += p.color[i][k] * C[i] / area;
+    }
+    flat = flat && p.color[0][k] == p.color[1][k] &&
+           p.color[0][k] == p.color[2][k];
+  }
+
+  x0 = max(x0, p.min_x);
+  y0 = max(y0, p.min_y);
+  x1 = min(x1, p.max_x);
+  y1 = min(y1, p.max_y);
+
+  for (int y = y0; y <= y1; y++) {
+    const float yc = y + 0.5f;
+    int left = x0, right = x1 + 1; // [left, right)
+
+    for (int i = 0; i < 3; i++) {
+      const float k = B[i] * yc + C[i];
+      // top-left rule so shared edges are drawn exactly once
+      const bool inclusive = A[i] > 0 || (A[i] == 0 && B[i] < 0);
+      if (A[i] == 0) {
+        if (k < 0 || (k == 0 && !inclusive))
+          right = left;
+        continue;
+      }
+      const float t = -k / A[i] - 0.5f;
+      if (A[i] > 0) {
+        const int l = inclusive ? (int)ceil(t) : (int)floor(t) + 1;
+        left = max(left, l);
+      } else {
+        const int r = inclusive ? (int)floor(t) + 1 : (int)ceil(t);
+        right = min(right, r);
+      }
+    }
+    if (left >= right)
+      continue;
+
+    GLubyte *row = canvas.bytes.data() + 4 * (y * canvas.width + left);
+    if (flat) {
+      fill_span(row, right - left, p.color[0]);
+    } else {
+      // anchor at x = 0 so the result doesn't depend on the tile split
+      long long c[4], dc[4];
+      for (int k = 0; k < 4; k++) {
+        dc[k] = (long long)(cx[k] * 65536);
+        c[k] = (long long)((c0[k] + cx[k] * 0.5f + cy[k] * yc) * 65536) +
+               dc[k] * left;
+      }
+      fill_span_gradient(row, right - left, c, dc);
+    }
+  }
+}
+
+/**
+ * @brief Rasterise the batches into the canvas, in order.
+ *
+ * @param canvas target image, blended in place
+ * @param batches recorded drawing commands
+ * @param tile_size edge length of the screen tiles used for binning
+ */
+static void draw(Image &canvas, const vector<Batch> &batches,
+                 int tile_size = 64) {
+  if (canvas.width <= 0 || canvas.height <= 0)
+    return;
+
+  vector<Primitive> prims;
+  for (const auto &batch : batches)
+    batch.assemble(prims);
+  if (prims.empty())
+    return;
+
+  const int tiles_x = (canvas.width + tile_size - 1) / tile_size;
+  const int tiles_y = (canvas.height + tile_size - 1) / tile_size;
+  const int num_tiles = tiles_x * tiles_y;
+  const int num_prims = (int)prims.size();
+
+  // bin in parallel chunks; concatenating chunk bins keeps submission order
+  const int chunks = min(Parallel::worker_count(),
+                         max(1, num_prims / 4096));
+  vector<vector<vector<int>>> chunk_bins(chunks,
+                                         vector<vector<int>>(num_tiles));
+  Parallel::parallel_each(0, chunks, [&](int c) {
+    const int s = (int)((long long)num_prims * c / chunks);
+    const int e = (int)((long long)num_prims * (c + 1) / chunks);
+    auto &bins = chunk_bins[c];
+    for (int i = s; i < e; i++) {
+      const Primitive &p = prims[i];
+      const int tx0 = max(0, p.min_x) / tile_size;
+      const int ty0 = max(0, p.min_y) / tile_size;
+      const int tx1 = min(canvas.width - 1, p.max_x) / tile_size;
+      const int ty1 = min(canvas.height - 1, p.max_y) / tile_size;
+      if (p.max_x < 0 || p.max_y < 0 || p.min_x >= canvas.width ||
+          p.min_y >= canvas.height)
+        continue;
+      for (int ty = ty0; ty <= ty1; ty++)
+        for (int tx = tx0; tx <= tx1; tx++)
+          bins[ty * tiles_x + tx].push_back(i);
+    }
+  });
+
+  Parallel::parallel_each(0, num_tiles, [&](int t) {
+    const int x0 = (t % tiles_x) * tile_size;
+    const int y0 = (t / tiles_x) * tile_size;
+    const int x1 = min(x0 + tile_size, canvas.width) - 1;
+    const int y1 = min(y0 + tile_size, canvas.height) - 1;
+
+    for (const auto &bins : chunk_bins) {
+      for (int i : bins[t]) {
+        const Primitive &p = prims[i];
+        if (p.rect)
+          draw_rect(canvas, p, x0, y0, x1, y1);
+        else
+          draw_triangle(canvas, p, x0, y0, x1, y1);
+      }
+    }
+  });
+}
+
+/**
+ * @brief Software counterpart of `GLHelper::gl_draw_shape`.
+ *
+ * ```
+ * Rasterizer::draw_shape(canvas, GL_POINTS, [&](Rasterizer::Batch &b) {
+ *   b.set_color(color);
+ *   b.set_point(50, 50);
+ * });
+ * ```
+ */
+static void draw_shape(Image &canvas, int drawing_mode,
+                       function<void(Batch &)> drawing_funcs) {
+  vector<Batch> batches{Batch{drawing_mode}};
+  drawing_funcs(batches[0]);
+  draw(canvas, batches);
+}
+
+} // namespace Rasterizer
+
+#endif // __RASTERIZER_H__
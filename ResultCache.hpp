@@ -0,0 +1,309 @@
+/**
+ *
+ * @file content-addressed memoisation of ImageUtils operations.
+ *
+ * Results are keyed by a hash of the input image(s) and the operation
+ * parameters, kept in an in-memory LRU bounded by a byte budget, and
+ * optionally persisted to a directory so later runs can reuse them.
+ */
+
+#if !defined(__RESULT_CACHE_H__)
+#define __RESULT_CACHE_H__
+
+#include "Hash.hpp"
+#include "Image.hpp"
+#include "ImageUtils.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+namespace ResultCache {
+
+struct Stats {
+  size_t hits = 0;      // served from memory
+  size_t disk_hits = 0; // served from the on-disk store
+  size_t misses = 0;    // computed
+  size_t evictions = 0; // dropped from memory to stay within budget
+};
+
+class Cache {
+public:
+  /**
+   * @param budget maximum bytes of results kept in memory
+   * @param directory on-disk store; empty disables it
+   */
+  Cache(size_t budget = 256 << 20, const string &directory = "")
+      : byte_budget{budget}, dir{directory} {
+    if (!dir.empty())
+      filesystem::create_directories(dir);
+  }
+
+  bool get(uint64_t key, Image &out) { return lookup(key, &out, nullptr); }
+  bool get(uint64_t key, double &out) { return lookup(key, nullptr, &out); }
+
+  void put(uint64_t key, const Image &img) {
+    Entry e{key, true, img, 0, img.bytes.size() + sizeof(Entry)};
+    insert(e);
+    store(e);
+  }
+
+  void put(uint64_t key, double value) {
+    Entry e{key, false, Image{}, value, sizeof(Entry)};
+    insert(e);
+    store(e);
+  }
+
+  /**
+   * @brief return the cached image for `key`, computing and storing it on a
+   * miss.
+   */
+  Image memoize(uint64_t key, function<Image()> compute) {
+    Image result;
+    if (get(key, result))
+      return result;
+    result = compute();
+    put(key, result);
+    return result;
+  }
+
+  double memoize(uint64_t key, function<double()> compute) {
+    double result;
+    if (get(key, result))
+      return result;
+    result = compute();
+    put(key, result);
+    return result;
+  }
+
+  Stats stats() {
+    lock_guard<mutex> lock{guard};
+    return counters;
+  }
+
+  size_t bytes_used() {
+    lock_guard<mutex> lock{guard};
+    return used;
+  }
+
+  void clear() {
+    lock_guard<mutex> lock{guard};
+    lru.clear();
+    index.clear();
+    used = 0;
+  }
+
+private:
+  struct Entry {
+    uint64_t key;
+    bool is_image;
+    Image image;
+    double scalar;
+    size_t bytes;
+  };
+
+  size_t byte_budget;
+  string dir;
+
+  mutex guard;
+  list<Entry> lru; // most recently used first
+  unordered_map<uint64_t, list<Entry>::iterator> index;
+  size_t used = 0;
+  Stats counters;
+
+  bool lookup(uint64_t key, Image *img, double *scalar) {
+    {
+      lock_guard<mutex> lock{guard};
+      auto it = index.find(key);
+      if (it != index.end() && it->second->is_image == (img != nullptr)) {
+        lru.splice(lru.begin(), lru, it->second);
+        if (img)
+          *img = it->second->image;
+        else
+          *scalar = it->second->scalar;
+        counters.hits++;
+        return true;
+      }
+    }
+
+    Entry e;
+    if (load(key, img != nullptr, e)) {
+      if (img)
+        *img = e.image;
+      else
+        *scalar = e.scalar;
+      insert(e);
+      lock_guard<mutex> lock{guard};
+      counters.disk_hits++;
+      return true;
+    }
+
+    lock_guard<mutex> lock{guard};
+    counters.misses++;
+    return false;
+  }
+
+  void insert(const Entry &e) {
+    lock_guard<mutex> lock{guard};
+    auto it = index.find(e.key);
+    if (it != index.end()) {
+      used -= it->second->bytes;
+      lru.erase(it->second);
+      index.erase(it);
+    }
+    if (e.bytes > byte_budget)
+      return;
+
+    lru.push_front(e);
+    index[e.key] = lru.begin();
+    used += e.bytes;
+
+    while (used > byte_budget) {
+      used -= lru.back().bytes;
+      index.erase(lru.back().key);
+      lru.pop_back();
+      counters.evictions++;
+    }
+  }
+
+  string path_of(uint64_t key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return dir + "/" + name;
+  }
+
+  // file layout: 'I' width height bytes... | 'S' double
+  void store(const Entry &e) const {
+    if (dir.empty())
+      return;
+    const string path = path_of(e.key);
+    const string tmp = path + ".tmp";
+
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if (file == NULL)
+      return;
+    bool ok;
+    if (e.is_image) {
+      const int size[2] = {e.image.width, e.image.height};
+      ok = fputc('I', file) != EOF && fwrite(size, sizeof(size), 1, file) &&
+           (e.image.bytes.empty() ||
+            fwrite(e.image.bytes.data(), e.image.bytes.size(), 1, file));
+    } else {
+      ok = fputc('S', file) != EOF &&
+           fwrite(&e.scalar, sizeof(e.scalar), 1, file);
+    }
+    ok = fclose(file) == 0 && ok;
+
+    // rename so concurrent readers never see a partial file
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+      remove(tmp.c_str());
+  }
+
+  bool load(uint64_t key, bool is_image, Entry &e) const {
+    if (dir.empty())
+      return false;
+    FILE *file = fopen(path_of(key).c_str(), "rb");
+    if (file == NULL)
+      return false;
+
+    e.key = key;
+    e.is_image = is_image;
+    bool ok = fgetc(file) == (is_image ? 'I' : 'S');
+    if (ok && is_image) {
+      int size[2];
+      ok = fread(size, sizeof(size), 1, file) == 1 && size[0] >= 0 &&
+           size[1] >= 0;
+      if (ok) {
+        e.image.width = size[0];
+        e.image.height = size[1];
+        e.image.bytes.resize((size_t)size[0] * size[1] * 4);
+        ok = e.image.bytes.empty() ||
+             fread(e.image.bytes.data(), e.image.bytes.size(), 1, file) == 1;
+      }
+      e.bytes = e.image.bytes.size() + sizeof(Entry);
+    } else if (ok) {
+      ok = fread(&e.scalar, sizeof(e.scalar), 1, file) == 1;
+      e.bytes = sizeof(Entry);
+    }
+    fclose(file);
+    return ok;
+  }
+};
+
+/**
+ * @brief cache key for an operation applied to a list of content hashes
+ * (images, parameters).
+ */
+static uint64_t key(const char *op, initializer_list<uint64_t> parts) {
+  uint64_t h = Hash::text(op);
+  for (uint64_t p : parts)
+    h = Hash::combine(h, p);
+  return h;
+}
+
+/**
+ * @brief content hash of the mosaic thumbnail set, computed once.
+ */
+static uint64_t mosaic_dataset_hash() {
+  static uint64_t h = [] {
+    uint64_t h = 0;
+    for (const auto &img : ImageUtils::mosaic_dataset().images)
+      h = Hash::combine(h, Hash::image(img));
+    return h;
+  }();
+  return h;
+}
+
+static float structural_similarity(Cache &cache, Image &src, Image &target) {
+  const uint64_t k =
+      key("structural_similarity", {Hash::image(src), Hash::image(target)});
+  return (float)cache.memoize(
+      k, [&]() -> double {
+        return ImageUtils::structural_similarity(src, target);
+      });
+}
+
+static float mse(Cache &cache, Image &src, Image &tar) {
+  const uint64_t k = key("mse", {Hash::image(src), Hash::image(tar)});
+  return (float)cache.memoize(
+      k, [&]() -> double { return ImageUtils::mse(src, tar); });
+}
+
+static double image_l1(Cache &cache, Image &src, Image &tar) {
+  const uint64_t k = key("image_l1", {Hash::image(src), Hash::image(tar)});
+  return cache.memoize(
+      k, [&]() -> double { return ImageUtils::image_l1(src, tar); });
+}
+
+static Image generate_edge_image(Cache &cache, Image &img,
+                                 float threshold = 127) {
+  const uint64_t k =
+      key("generate_edge_image",
+          {Hash::image(img), Hash::bytes(&threshold, sizeof(threshold))});
+  return cache.memoize(k, [&]() -> Image {
+    return ImageUtils::generate_edge_image(img, threshold);
+  });
+}
+
+/**
+ * @brief `ImageUtils::mosaics`, which paints into `img` in place; the cache
+ * stores the painted image.
+ */
+static Image mosaics(Cache &cache, Image &img) {
+  const uint64_t k = key("mosaics", {Hash::image(img), mosaic_dataset_hash(),
+                                     (uint64_t)ImageUtils::MOSAIC_BLOCK});
+  img = cache.memoize(k, [&]() -> Image {
+    ImageUtils::mosaics(img);
+    return img;
+  });
+  return {};
+}
+
+} // namespace ResultCache
+
+#endif // __RESULT_CACHE_H__
@@ -0,0 +1,279 @@
+/**
+ *
+ * @file content-aware resizing by seam carving.
+ *
+ * The energy of a pixel is its Sobel gradient magnitude; the cheapest
+ * 8-connected top-to-bottom seam is found by dynamic programming over the
+ * cumulative cost M(y, x) = e(y, x) + min(M(y - 1, x - 1 .. x + 1)) and
+ * removed, one seam at a time.
+ *
+ * Removing a seam only disturbs the pixels next to it, so instead of
+ * rebuilding everything the carver recomputes the energy in a narrow band
+ * around the seam and re-runs the DP row by row over the columns that can
+ * have changed: the band plus the spread of the changes from the row above.
+ * The spread is shrunk to the columns whose cost actually changed, so it
+ * usually dies out within a few rows instead of widening into a cone.
+ *
+ * Horizontal seams are removed by carving the transposed image.
+ */
+
+#if !defined(__SEAM_CARVE_H__)
+#define __SEAM_CARVE_H__
+
+#include "ColorConvert.hpp"
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+namespace SeamCarve {
+
+/**
+ * @brief one DP row over columns [lo, hi] of a row `width` wide.
+ *
+ * The interior is a branch-free three-way min over shifted loads, which
+ * compilers vectorise into packed min instructions.
+ */
+static void cost_row(const float *above, const float *energy, float *cost,
+                     int lo, int hi, int width) {
+  if (width == 1) {
+    cost[0] = energy[0] + above[0];
+    return;
+  }
+  if (lo == 0) {
+    cost[0] = energy[0] + min(above[0], above[1]);
+    lo = 1;
+  }
+  const int end = min(hi, width - 2);
+  for (int x = lo; x <= end; x++) {
+    const float a = above[x - 1] < above[x] ? above[x - 1] : above[x];
+    cost[x] = energy[x] + (a < above[x + 1] ? a : above[x + 1]);
+  }
+  if (hi == width - 1)
+    cost[hi] = energy[hi] + min(above[hi - 1], above[hi]);
+}
+
+class Carver {
+public:
+  /**
+   * @brief start from w x h packed RGBA pixels.
+   */
+  Carver(const vector<uint32_t> &px, int w, int h)
+      : width{w}, height{h}, stride{w}, pixels{px}, grey{w, h}, energy{w, h},
+        cost{w, h}, seam(h), previous(w) {
+    Parallel::parallel_for(0, height, [&](int s, int e) {
+      for (int y = s; y < e; y++) {
+        const GLubyte *p = reinterpret_cast<const GLubyte *>(
+            pixels.data() + (size_t)y * stride);
+        float *g = grey.row(y);
+        for (int x = 0; x < width; x++, p += 4)
+          g[x] = ColorConvert::grey_f(p[0], p[1], p[2]);
+      }
+    });
+    Parallel::parallel_for(0, height, [&](int s, int e) {
+      for (int y = s; y < e; y++)
+        update_energy(y, 0, width - 1);
+    });
+    copy(energy.row(0), energy.row(0) + width, cost.row(0));
+    for (int y = 1; y < height; y++)
+      cost_row(cost.row(y - 1), energy.row(y), cost.row(y), 0, width - 1,
+               width);
+  }
+
+  /**
+   * @brief remove `count` vertical seams (never below one column).
+   */
+  void remove(int count) {
+    for (int i = 0; i < count && width > 1; i++) {
+      find_seam();
+      remove_seam();
+      update();
+    }
+  }
+
+  /**
+   * @brief the current width x height pixels, packed.
+   */
+  vector<uint32_t> result() const {
+    vector<uint32_t> out((size_t)width * height);
+    for (int y = 0; y < height; y++)
+      copy(pixels.begin() + (size_t)y * stride,
+           pixels.begin() + (size_t)y * stride + width,
+           out.begin() + (size_t)y * width);
+    return out;
+  }
+
+  int width, height;
+
+private:
+  /**
+   * @brief Sobel magnitude for columns [lo, hi] of row y. Reads past the
+   * border are clamped, so the border itself has no artificial edge.
+   */
+  void update_energy(int y, int lo, int hi) {
+    const float *r0 = grey.row(max(y - 1, 0));
+    const float *r1 = grey.row(y);
+    const float *r2 = grey.row(min(y + 1, height - 1));
+    float *e = energy.row(y);
+    for (int x = lo; x <= hi; x++) {
+      const int xl = max(x - 1, 0), xr = min(x + 1, width - 1);
+      const float gx = (r0[xr] - r0[xl]) + 2 * (r1[xr] - r1[xl]) +
+                       (r2[xr] - r2[xl]);
+      const float gy = (r2[xl] - r0[xl]) + 2 * (r2[x] - r0[x]) +
+                       (r2[xr] - r0[xr]);
+      e[x] = sqrt(gx * gx + gy * gy);
+    }
+  }
+
+  void find_seam() {
+    const float *last = cost.row(height - 1);
+    int x = (int)(min_element(last, last + width) - last);
+    seam[height - 1] = x;
+    for (int y = height - 1; y > 0; y--) {
+      const float *above = cost.row(y - 1);
+      int best = x;
+      if (x > 0 && above[x - 1] < above[best])
+        best = x - 1;
+      if (x < width - 1 && above[x + 1] < above[best])
+        best = x + 1;
+      x = best;
+      seam[y - 1] = x;
+    }
+  }
+
+  void remove_seam() {
+    Parallel::parallel_for(0, height, [&](int s, int e) {
+      for (int y = s; y < e; y++) {
+        const int x = seam[y], n = width - x - 1;
+        const size_t at = (size_t)y * stride + x;
+        memmove(&pixels[at], &pixels[at + 1], n * sizeof(uint32_t));
+        memmove(&grey.data[at], &grey.data[at + 1], n * sizeof(float));
+        memmove(&energy.data[at], &energy.data[at + 1], n * sizeof(float));
+        memmove(&cost.data[at], &cost.data[at + 1], n * sizeof(float));
+      }
+    }, 64);
+    width--;
+  }
+
+  /**
+   * @brief columns [lo, hi] of row y whose energy the last seam can have
+   * changed: the Sobel window of a pixel sees the seam in rows y - 1 .. y + 1.
+   */
+  void energy_band(int y, int &lo, int &hi) const {
+    int s0 = seam[y], s1 = seam[y];
+    if (y > 0) {
+      s0 = min(s0, seam[y - 1]);
+      s1 = max(s1, seam[y - 1]);
+    }
+    if (y < height - 1) {
+      s0 = min(s0, seam[y + 1]);
+      s1 = max(s1, seam[y + 1]);
+    }
+    lo = max(0, s0 - 2);
+    hi = min(width - 1, s1 + 1);
+  }
+
+  void update() {
+    Parallel::parallel_for(0, height, [&](int s, int e) {
+      for (int y = s; y < e; y++) {
+        int lo, hi;
+        energy_band(y, lo, hi);
+        update_energy(y, lo, hi);
+      }
+    }, 64);
+
+    // columns of the previous row whose cost changed; empty when lo > hi
+    int changed_lo = 0, changed_hi = -1;
+    for (int y = 0; y < height; y++) {
+      int lo, hi;
+      energy_band(y, lo, hi);
+      if (changed_lo <= changed_hi) {
+        lo = min(lo, max(0, changed_lo - 1));
+        hi = max(hi, min(width - 1, changed_hi + 1));
+      }
+
+      float *row = cost.row(y);
+      // the old (shifted) costs, to see where the new ones differ
+      copy(row + lo, row + hi + 1, previous.begin());
+
+      if (y == 0)
+        copy(energy.row(0) + lo, energy.row(0) + hi + 1, row + lo);
+      else
+        cost_row(cost.row(y - 1), energy.row(y), row, lo, hi, width);
+
+      changed_lo = hi + 1;
+      changed_hi = lo - 1;
+      for (int x = lo; x <= hi; x++) {
+        if (row[x] != previous[x - lo]) {
+          changed_lo = min(changed_lo, x);
+          changed_hi = max(changed_hi, x);
+        }
+      }
+    }
+  }
+
+  int stride;
+  vector<uint32_t> pixels;
+  Plane<float> grey, energy, cost; // `stride` wide, first `width` in use
+  vector<int> seam;
+  vector<float> previous;
+};
+
+static vector<uint32_t> transpose(const vector<uint32_t> &px, int w, int h) {
+  vector<uint32_t> out(px.size());
+  const int block = 32;
+  Parallel::parallel_for(0, (h + block - 1) / block, [&](int s, int e) {
+    for (int by = s * block; by < min(h, e * block); by += block)
+      for (int bx = 0; bx < w; bx += block)
+        for (int y = by; y < min(h, by + block); y++)
+          for (int x = bx; x < min(w, bx + block); x++)
+            out[(size_t)x * h + y] = px[(size_t)y * w + x];
+  });
+  return out;
+}
+
+/**
+ * @brief shrink the image to target_width x target_height by removing the
+ * lowest-energy vertical, then horizontal, seams. Targets larger than the
+ * image leave that dimension unchanged.
+ */
+static Image carve(Image &img, int target_width, int target_height) {
+  int w = img.width, h = img.height;
+  target_width = max(1, min(target_width, w));
+  target_height = max(1, min(target_height, h));
+  if (w == 0 || h == 0)
+    return img;
+
+  vector<uint32_t> px((size_t)w * h);
+  memcpy(px.data(), img.bytes.data(), px.size() * 4);
+
+  if (target_width < w) {
+    Carver c{px, w, h};
+    c.remove(w - target_width);
+    px = c.result();
+    w = c.width;
+  }
+  if (target_height < h) {
+    Carver c{transpose(px, w, h), h, w};
+    c.remove(h - target_height);
+    h = c.width;
+    px = transpose(c.result(), h, w);
+  }
+
+  Image out;
+  out.width = w;
+  out.height = h;
+  out.bytes.resize(px.size() * 4);
+  memcpy(out.bytes.data(), px.data(), out.bytes.size());
+  return out;
+}
+
+} // namespace SeamCarve
+
+#endif // __SEAM_CARVE_H__
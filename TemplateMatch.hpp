@@ -0,0 +1,243 @@
+/**
+ *
+ * @file template matching by normalised cross-correlation.
+ *
+ * The numerator of the NCC, the correlation of the source with the
+ * zero-mean template, is computed for every offset at once as a product of
+ * spectra (FFT.hpp). The per-offset source statistics in the denominator
+ * come from integral images of the source and of its square. The whole
+ * score map therefore costs O(N log N) rather than O(N * M).
+ *
+ * A `Matcher` keeps the source spectrum and integral images, so any number
+ * of templates can be matched against one source for the price of one
+ * forward and one inverse transform each.
+ */
+
+#if !defined(__TEMPLATE_MATCH_H__)
+#define __TEMPLATE_MATCH_H__
+
+#include "FFT.hpp"
+#include "Image.hpp"
+#include "ImageUtils.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+namespace TemplateMatch {
+
+struct Match {
+  int x, y; // offset of the template's first pixel in the source
+  float score;
+};
+
+/**
+ * @brief the best k local maxima of a score map, at least `min_distance`
+ * apart (Chebyshev distance) and scoring at least `min_score`.
+ */
+static vector<Match> peaks(const Plane<float> &scores, int k, int min_distance,
+                           float min_score = -1) {
+  vector<Match> candidates;
+  if (k <= 0)
+    return candidates;
+
+  vector<vector<Match>> partial(scores.height);
+  Parallel::parallel_for(0, scores.height, [&](int s, int e) {
+    for (int y = s; y < e; y++) {
+      for (int x = 0; x < scores.width; x++) {
+        const float v = scores(y, x);
+        if (v < min_score)
+          continue;
+        bool is_max = true;
+        for (int dy = -1; dy <= 1 && is_max; dy++)
+          for (int dx = -1; dx <= 1; dx++)
+            if (scores.valid_point(y + dy, x + dx) &&
+                scores(y + dy, x + dx) > v) {
+              is_max = false;
+              break;
+            }
+        if (is_max)
+          partial[y].push_back(Match{x, y, v});
+      }
+    }
+  });
+  for (auto &p : partial)
+    candidates.insert(candidates.end(), p.begin(), p.end());
+
+  // stable, so equal scores keep raster order and the result is
+  // deterministic
+  stable_sort(candidates.begin(), candidates.end(),
+              [](const Match &a, const Match &b) { return a.score > b.score; });
+
+  vector<Match> found;
+  for (auto &c : candidates) {
+    bool clear = true;
+    for (auto &f : found)
+      if (max(abs(c.x - f.x), abs(c.y - f.y)) < min_distance) {
+        clear = false;
+        break;
+      }
+    if (!clear)
+      continue;
+    found.push_back(c);
+    if ((int)found.size() == k)
+      break;
+  }
+  return found;
+}
+
+class Matcher {
+public:
+  /**
+   * @brief transform the source once for any number of templates.
+   */
+  Matcher(Image &source)
+      : width{source.width}, height{source.height},
+        pad_w{FFT::next_size(max(source.width, 1))},
+        pad_h{FFT::next_size(max(source.height, 1))},
+        sum{source.width + 1, source.height + 1},
+        sum_sq{source.width + 1, source.height + 1} {
+    Plane<float> grey = ImageUtils::grey_plane(source);
+
+    // the template is zero-mean, so removing the source mean leaves the
+    // correlation unchanged and keeps the float spectra well conditioned
+    double total = 0;
+    for (float v : grey.data)
+      total += v;
+    const float mean =
+        grey.data.empty() ? 0 : (float)(total / grey.data.size());
+    for (float &v : grey.data)
+      v -= mean;
+
+    // rows in parallel, then running column sums
+    Parallel::parallel_for(0, height, [&](int s, int e) {
+      for (int y = s; y < e; y++) {
+        double a = 0, b = 0;
+        const float *g = grey.row(y);
+        double *rs = sum.row(y + 1), *rq = sum_sq.row(y + 1);
+        for (int x = 0; x < width; x++) {
+          a += g[x];
+          b += (double)g[x] * g[x];
+          rs[x + 1] = a;
+          rq[x + 1] = b;
+        }
+      }
+    });
+    for (int y = 1; y <= height; y++) {
+      double *rs = sum.row(y), *rq = sum_sq.row(y);
+      const double *ps = sum.row(y - 1), *pq = sum_sq.row(y - 1);
+      for (int x = 0; x <= width; x++) {
+        rs[x] += ps[x];
+        rq[x] += pq[x];
+      }
+    }
+
+    spectrum = FFT::forward(grey, pad_w, pad_h);
+  }
+
+  /**
+   * @brief NCC of the template at every offset where it fits entirely in
+   * the source: a (height - th + 1) x (width - tw + 1) plane of scores in
+   * [-1, 1]. Flat windows (or a flat template) score 0.
+   */
+  Plane<float> score_map(Image &templ) const {
+    const int tw = templ.width, th = templ.height;
+    if (tw <= 0 || th <= 0 || tw > width || th > height)
+      return Plane<float>{};
+
+    Plane<float> t = ImageUtils::grey_plane(templ);
+    double total = 0;
+    for (float v : t.data)
+      total += v;
+    const float mean = (float)(total / t.data.size());
+    double t_var = 0;
+    for (float &v : t.data) {
+      v -= mean;
+      t_var += (double)v * v;
+    }
+
+    FFT::Spectrum product = FFT::forward(t, pad_w, pad_h);
+    Parallel::parallel_for(0, pad_h, [&](int s, int e) {
+      for (int y = s; y < e; y++) {
+        const FFT::Complex *f = spectrum.row(y);
+        FFT::Complex *p = product.row(y);
+        for (int x = 0; x < product.columns(); x++)
+          p[x] = FFT::mul(f[x], conj(p[x]));
+      }
+    });
+    const int ow = width - tw + 1, oh = height - th + 1;
+    Plane<float> corr = FFT::inverse(move(product), oh);
+
+    const double n = (double)tw * th;
+    // below this a window is treated as flat: a standard deviation of about
+    // 1 / 32 of a grey level
+    const double flat = n / 1024;
+
+    Plane<float> scores{ow, oh};
+    Parallel::parallel_for(0, oh, [&](int s, int e) {
+      for (int y = s; y < e; y++) {
+        const double *s0 = sum.row(y), *s1 = sum.row(y + th);
+        const double *q0 = sum_sq.row(y), *q1 = sum_sq.row(y + th);
+        for (int x = 0; x < ow; x++) {
+          const double a = s1[x + tw] - s1[x] - s0[x + tw] + s0[x];
+          const double b = q1[x + tw] - q1[x] - q0[x + tw] + q0[x];
+          const double f_var = b - a * a / n;
+          if (f_var <= flat || t_var <= flat) {
+            scores(y, x) = 0;
+            continue;
+          }
+          const double v = corr(y, x) / sqrt(f_var * t_var);
+          scores(y, x) = (float)min(1.0, max(-1.0, v));
+        }
+      }
+    });
+    return scores;
+  }
+
+  /**
+   * @brief the k best placements of the template. Peaks closer than
+   * `min_distance` to a better one are suppressed; by default that is half
+   * the template size.
+   */
+  vector<Match> find(Image &templ, int k = 1, int min_distance = -1,
+                     float min_score = -1) const {
+    if (min_distance < 0)
+      min_distance = max(1, max(templ.width, templ.height) / 2);
+    return peaks(score_map(templ), k, min_distance, min_score);
+  }
+
+  /**
+   * @brief `find` for a batch of templates against the shared source
+   * transform.
+   */
+  vector<vector<Match>> find(vector<Image> &templates, int k = 1,
+                             int min_distance = -1,
+                             float min_score = -1) const {
+    vector<vector<Match>> out;
+    for (auto &t : templates)
+      out.push_back(find(t, k, min_distance, min_score));
+    return out;
+  }
+
+  int width, height;
+
+private:
+  int pad_w, pad_h;
+  Plane<double> sum, sum_sq; // integral images of the zero-mean source
+  FFT::Spectrum spectrum;
+};
+
+/**
+ * @brief one-off search for the best placement of `templ` in `source`.
+ */
+static Match locate(Image &source, Image &templ) {
+  vector<Match> m = Matcher(source).find(templ, 1);
+  return m.empty() ? Match{0, 0, 0} : m[0];
+}
+
+} // namespace TemplateMatch
+
+#endif // __TEMPLATE_MATCH_H__
@@ -0,0 +1,491 @@
+/**
+ *
+ * @file tiled, random-access native image container.
+ *
+ * Layout (host byte order, like Bitmap.cpp):
+ *
+ *   header   64 bytes, see `TiledHeader`
+ *   index    one `TileEntry` per tile, row-major over the tile grid
+ *   tiles    each starting on an `alignment` boundary (4 KiB by default) so
+ *            uncompressed tiles can be mmapped directly
+ *
+ * A tile holds its pixels row by row, tightly packed (edge tiles are
+ * smaller). With `COMPRESS_DELTA_RLE` a tile is stored as the left/up
+ * prediction residual, run-length coded; a tile whose coded form isn't
+ * smaller is stored raw, which the reader detects from `stored == raw`.
+ */
+
+#if !defined(__TILED_IMAGE_H__)
+#define __TILED_IMAGE_H__
+
+#include "ColorConvert.hpp"
+#include "Image.hpp"
+#include "Parallel.hpp"
+#include "Plane.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#if !defined(_WIN32)
+#include <sys/types.h>
+#endif
+
+using namespace std;
+
+namespace TiledImage {
+
+enum PixelFormat : uint32_t { RGBA8 = 0, RGB8 = 1, GRAY8 = 2 };
+enum Compression : uint32_t { COMPRESS_NONE = 0, COMPRESS_DELTA_RLE = 1 };
+
+static const char MAGIC[4] = {'T', 'I', 'M', 'G'};
+static const uint32_t VERSION = 1;
+
+struct TiledHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t width, height;
+  uint32_t tile_width, tile_height;
+  uint32_t format;
+  uint32_t compression;
+  uint32_t tiles_x, tiles_y;
+  uint32_t alignment;
+  uint32_t reserved0;
+  uint64_t index_offset;
+  uint64_t reserved1;
+};
+static_assert(sizeof(TiledHeader) == 64, "header must stay 64 bytes");
+
+struct TileEntry {
+  uint64_t offset;
+  uint32_t stored; // bytes on disk
+  uint32_t raw;    // bytes once decoded
+};
+
+struct WriteOptions {
+  PixelFormat format = RGBA8;
+  Compression compression = COMPRESS_DELTA_RLE;
+  int tile_size = 256;
+  uint32_t alignment = 4096;
+};
+
+static int channels_of(uint32_t format) {
+  switch (format) {
+  case RGB8:
+    return 3;
+  case GRAY8:
+    return 1;
+  default:
+    return 4;
+  }
+}
+
+/**
+ * @brief residual of each byte against the same channel of the pixel to its
+ * left (or above, for the first column), then PackBits-style run-length
+ * coding: control n < 128 copies n + 1 literals, n >= 128 repeats the next
+ * byte n - 126 times.
+ */
+static vector<uint8_t> encode_tile(const vector<uint8_t> &raw, int row_bytes,
+                                   int channels) {
+  vector<uint8_t> residual(raw.size());
+  for (size_t i = 0; i < raw.size(); i++) {
+    const size_t col = i % row_bytes;
+    uint8_t pred = 0;
+    if (col >= (size_t)channels)
+      pred = raw[i - channels];
+    else if (i >= (size_t)row_bytes)
+      pred = raw[i - row_bytes];
+    residual[i] = raw[i] - pred;
+  }
+
+  vector<uint8_t> out;
+  out.reserve(raw.size() / 2);
+  size_t i = 0;
+  const size_t n = residual.size();
+  while (i < n) {
+    size_t run = 1;
+    while (i + run < n && run < 129 && residual[i + run] == residual[i])
+      run++;
+    if (run >= 2) {
+      out.push_back((uint8_t)(run + 126));
+      out.push_back(residual[i]);
+      i += run;
+      continue;
+    }
+    // literals until the next run of 2 or more
+    size_t lit = 1;
+    while (i + lit < n && lit < 128 &&
+           !(i + lit + 1 < n && residual[i + lit] == residual[i + lit + 1]))
+      lit++;
+    out.push_back((uint8_t)(lit - 1));
+    out.insert(out.end(), residual.begin() + i, residual.begin() + i + lit);
+    i += lit;
+  }
+  return out;
+}
+
+/**
+ * @brief seek to an absolute 64-bit offset. `long` is 32 bits on Windows, so
+ * plain fseek can't reach tiles past 2 GiB there.
+ */
+static bool seek(FILE *file, uint64_t offset) {
+#if defined(_WIN32)
+  return offset <= (uint64_t)INT64_MAX &&
+         _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+#else
+  // off_t is 32 bits on 32-bit builds without _FILE_OFFSET_BITS=64
+  const off_t pos = (off_t)offset;
+  return pos >= 0 && (uint64_t)pos == offset &&
+         fseeko(file, pos, SEEK_SET) == 0;
+#endif
+}
+
+static bool decode_tile(const uint8_t *in, size_t size, vector<uint8_t> &raw,
+                        int row_bytes, int channels) {
+  size_t o = 0;
+  for (size_t i = 0; i < size;) {
+    const uint8_t ctrl = in[i++];
+    if (ctrl < 128) {
+      const size_t lit = ctrl + 1;
+      if (i + lit > size || o + lit > raw.size())
+        return false;
+      memcpy(raw.data() + o, in + i, lit);
+      i += lit;
+      o += lit;
+    } else {
+      const size_t run = ctrl - 126;
+      if (i >= size || o + run > raw.size())
+        return false;
+      memset(raw.data() + o, in[i++], run);
+      o += run;
+    }
+  }
+  if (o != raw.size())
+    return false;
+
+  for (size_t i = 0; i < raw.size(); i++) {
+    const size_t col = i % row_bytes;
+    if (col >= (size_t)channels)
+      raw[i] += raw[i - channels];
+    else if (i >= (size_t)row_bytes)
+      raw[i] += raw[i - row_bytes];
+  }
+  return true;
+}
+
+/**
+ * @brief write a tiled image.
+ *
+ * `fetch(y, x, out)` stores the `channels_of(format)` bytes of pixel (y, x).
+ * Tiles are packed and compressed in parallel, then written in index order.
+ */
+static bool write_tiles(const char *path, int width, int height,
+                        const WriteOptions &opts,
+                        function<void(int, int, uint8_t *)> fetch) {
+  const int channels = channels_of(opts.format);
+  const int ts = opts.tile_size;
+  const uint32_t align = max<uint32_t>(1, opts.alignment);
+
+  TiledHeader header{};
+  memcpy(header.magic, MAGIC, 4);
+  header.version = VERSION;
+  header.width = width;
+  header.height = height;
+  header.tile_width = ts;
+  header.tile_height = ts;
+  header.format = opts.format;
+  header.compression = opts.compression;
+  header.tiles_x = (width + ts - 1) / ts;
+  header.tiles_y = (height + ts - 1) / ts;
+  header.alignment = align;
+  header.index_offset = sizeof(TiledHeader);
+
+  const int num_tiles = header.tiles_x * header.tiles_y;
+  vector<vector<uint8_t>> payload(num_tiles);
+  vector<TileEntry> index(num_tiles);
+
+  Parallel::parallel_each(0, num_tiles, [&](int t) {
+    const int x0 = (t % header.tiles_x) * ts;
+    const int y0 = (t / header.tiles_x) * ts;
+    const int tw = min(ts, width - x0);
+    const int th = min(ts, height - y0);
+
+    vector<uint8_t> raw((size_t)tw * th * channels);
+    uint8_t *p = raw.data();
+    for (int y = 0; y < th; y++)
+      for (int x = 0; x < tw; x++, p += channels)
+        fetch(y0 + y, x0 + x, p);
+
+    index[t].raw = (uint32_t)raw.size();
+    if (opts.compression == COMPRESS_DELTA_RLE) {
+      vector<uint8_t> coded = encode_tile(raw, tw * channels, channels);
+      if (coded.size() < raw.size())
+        raw.swap(coded);
+    }
+    index[t].stored = (uint32_t)raw.size();
+    payload[t].swap(raw);
+  });
+
+  uint64_t offset = header.index_offset + sizeof(TileEntry) * num_tiles;
+  for (auto &entry : index) {
+    offset = (offset + align - 1) / align * align;
+    entry.offset = offset;
+    offset += entry.stored;
+  }
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL)
+    return false;
+
+  bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+            (index.empty() ||
+             fwrite(index.data(), sizeof(TileEntry), index.size(), file) ==
+                 index.size());
+
+  uint64_t pos = header.index_offset + sizeof(TileEntry) * num_tiles;
+  static const uint8_t zeros[4096] = {0};
+  for (int t = 0; ok && t < num_tiles; t++) {
+    while (ok && pos < index[t].offset) {
+      const size_t pad = (size_t)min<uint64_t>(sizeof(zeros),
+                                               index[t].offset - pos);
+      ok = fwrite(zeros, pad, 1, file) == 1;
+      pos += pad;
+    }
+    ok = ok && fwrite(payload[t].data(), payload[t].size(), 1, file) == 1;
+    pos += payload[t].size();
+  }
+
+  ok = fclose(file) == 0 && ok;
+  return ok;
+}
+
+/**
+ * @brief write an RGBA image as `opts.format`: RGB8 drops alpha and GRAY8
+ * stores the luma of each pixel (`ColorConvert::grey8`).
+ */
+static bool write(const char *path, Image &img, WriteOptions opts = {}) {
+  const int channels = channels_of(opts.format);
+  return write_tiles(path, img.width, img.height, opts,
+                     [&](int y, int x, uint8_t *out) {
+                       const GLubyte *p =
+                           img.bytes.data() + 4 * ((size_t)y * img.width + x);
+                       if (channels == 1)
+                         *out = (uint8_t)ColorConvert::grey8(p[0], p[1], p[2]);
+                       else
+                         memcpy(out, p, channels);
+                     });
+}
+
+static bool write(const char *path, const Gray8 &img, WriteOptions opts = {}) {
+  opts.format = GRAY8;
+  return write_tiles(path, img.width, img.height, opts,
+                     [&](int y, int x, uint8_t *out) { *out = img(y, x); });
+}
+
+class Reader {
+public:
+  Reader(const char *path) {
+    file = fopen(path, "rb");
+    ok = file && load();
+    if (!ok) {
+      // an invalid file reads as empty rather than with its bogus size
+      header = TiledHeader{};
+      index.clear();
+    }
+  }
+
+  ~Reader() {
+    if (file)
+      fclose(file);
+  }
+
+  Reader(const Reader &) = delete;
+  Reader &operator=(const Reader &) = delete;
+
+  bool valid() const { return ok; }
+  int width() const { return header.width; }
+  int height() const { return header.height; }
+  int channels() const { return channels_of(header.format); }
+  PixelFormat format() const { return (PixelFormat)header.format; }
+  const TiledHeader &info() const { return header; }
+  const vector<TileEntry> &tiles() const { return index; }
+
+  /**
+   * @brief read the pixels in [from, to] (inclusive) as RGBA.
+   *
+   * Only the tiles overlapping the range are read from disk; they are
+   * decoded in parallel. Grey files are replicated into R, G and B and
+   * formats without alpha read as opaque.
+   */
+  Image read_region(const Point &from, const Point &to) {
+    Image out;
+    const int w = to.x - from.x + 1, h = to.y - from.y + 1;
+    out.width = max(w, 0);
+    out.height = max(h, 0);
+    out.bytes.assign((size_t)out.width * out.height * 4, 255);
+
+    const int c = channels();
+    for_region(from, to, [&](int y, int x, const uint8_t *p) {
+      GLubyte *q = out.bytes.data() +
+                   4 * ((size_t)(y - from.y) * out.width + (x - from.x));
+      if (c == 1) {
+        q[0] = q[1] = q[2] = p[0];
+      } else {
+        memcpy(q, p, c);
+      }
+    });
+    return out;
+  }
+
+  Image read() {
+    return read_region(Point{0, 0}, Point{width() - 1, height() - 1});
+  }
+
+  /**
+   * @brief read the first channel of the pixels in [from, to].
+   */
+  Gray8 read_region_gray(const Point &from, const Point &to) {
+    Gray8 out{max(to.x - from.x + 1, 0), max(to.y - from.y + 1, 0)};
+    for_region(from, to, [&](int y, int x, const uint8_t *p) {
+      out(y - from.y, x - from.x) = p[0];
+    });
+    return out;
+  }
+
+  /**
+   * @brief decoded bytes of one tile, row by row, or empty on error.
+   */
+  vector<uint8_t> read_tile(int t) {
+    vector<uint8_t> raw;
+    if (!ok || t < 0 || t >= (int)index.size())
+      return raw;
+    vector<uint8_t> stored;
+    if (!fetch(t, stored) || !decode(t, stored, raw))
+      raw.clear();
+    return raw;
+  }
+
+private:
+  FILE *file = NULL;
+  bool ok = false;
+  TiledHeader header{};
+  vector<TileEntry> index;
+
+  /**
+   * @brief read and validate the header and index. The tile grid must match
+   * the image size and every entry its tile, since the rest of the reader
+   * indexes with them unchecked.
+   */
+  bool load() {
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, MAGIC, 4) != 0 || header.version != VERSION ||
+        header.format > GRAY8 || header.compression > COMPRESS_DELTA_RLE ||
+        header.width > INT_MAX || header.height > INT_MAX ||
+        header.tile_width == 0 || header.tile_height == 0 ||
+        header.tile_width > INT_MAX || header.tile_height > INT_MAX)
+      return false;
+
+    const uint64_t tiles_x =
+        ((uint64_t)header.width + header.tile_width - 1) / header.tile_width;
+    const uint64_t tiles_y =
+        ((uint64_t)header.height + header.tile_height - 1) / header.tile_height;
+    if (header.tiles_x != tiles_x || header.tiles_y != tiles_y ||
+        tiles_x * tiles_y > INT_MAX)
+      return false;
+
+    index.resize((size_t)(tiles_x * tiles_y));
+    if (!seek(file, header.index_offset) ||
+        (!index.empty() &&
+         fread(index.data(), sizeof(TileEntry), index.size(), file) !=
+             index.size()))
+      return false;
+
+    for (int t = 0; t < (int)index.size(); t++)
+      if (index[t].raw != tile_bytes(t) || index[t].stored > index[t].raw)
+        return false;
+    return true;
+  }
+
+  int tile_w(int t) const {
+    return min<int>(header.tile_width,
+                    header.width - (t % header.tiles_x) * header.tile_width);
+  }
+
+  int tile_h(int t) const {
+    return min<int>(header.tile_height,
+                    header.height - (t / header.tiles_x) * header.tile_height);
+  }
+
+  uint64_t tile_bytes(int t) const {
+    return (uint64_t)tile_w(t) * tile_h(t) * channels();
+  }
+
+  bool fetch(int t, vector<uint8_t> &stored) {
+    stored.resize(index[t].stored);
+    return seek(file, index[t].offset) &&
+           (stored.empty() ||
+            fread(stored.data(), stored.size(), 1, file) == 1);
+  }
+
+  /**
+   * @brief the tile's pixels from its stored bytes; false unless they decode
+   * to exactly the tile's size.
+   */
+  bool decode(int t, vector<uint8_t> &stored, vector<uint8_t> &raw) const {
+    if (stored.size() != index[t].stored)
+      return false;
+    if (index[t].stored == index[t].raw) {
+      raw.swap(stored);
+    } else {
+      raw.resize(index[t].raw);
+      if (!decode_tile(stored.data(), stored.size(), raw,
+                       tile_w(t) * channels(), channels()))
+        return false;
+    }
+    return raw.size() == tile_bytes(t);
+  }
+
+  void for_region(const Point &from, const Point &to,
+                  function<void(int, int, const uint8_t *)> handler) {
+    if (!ok)
+      return;
+    const int x0 = max(from.x, 0), y0 = max(from.y, 0);
+    const int x1 = min(to.x, width() - 1), y1 = min(to.y, height() - 1);
+    if (x0 > x1 || y0 > y1)
+      return;
+
+    const int tw = header.tile_width, th = header.tile_height;
+    vector<int> wanted;
+    for (int ty = y0 / th; ty <= y1 / th; ty++)
+      for (int tx = x0 / tw; tx <= x1 / tw; tx++)
+        wanted.push_back(ty * header.tiles_x + tx);
+
+    // file reads are sequential, decoding is not
+    vector<vector<uint8_t>> stored(wanted.size());
+    for (size_t i = 0; i < wanted.size(); i++)
+      if (!fetch(wanted[i], stored[i]))
+        stored[i].clear();
+
+    const int c = channels();
+    Parallel::parallel_each(0, (int)wanted.size(), [&](int i) {
+      const int t = wanted[i];
+      vector<uint8_t> raw;
+      if (!decode(t, stored[i], raw))
+        return;
+
+      const int ox = (t % header.tiles_x) * tw;
+      const int oy = (t / header.tiles_x) * th;
+      const int w = tile_w(t);
+      for (int y = max(y0, oy); y <= min(y1, oy + tile_h(t) - 1); y++)
+        for (int x = max(x0, ox); x <= min(x1, ox + w - 1); x++)
+          handler(y, x,
+                  raw.data() + ((size_t)(y - oy) * w + (x - ox)) * c);
+    });
+  }
+};
+
+} // namespace TiledImage
+
+#endif // __TILED_IMAGE_H__